@@ -3,137 +3,1012 @@
  * Class: CS 451 - HW2 Memory Allocator w/Buddy System
  * Date: 2026 February 11
  */
+#define _GNU_SOURCE
 #include "balloc.h"
 #include "freelist.h"
+#include "lflist.h"
+#include "tree.h"
+#include "slab.h"
 #include "bbm.h"
+#include "bm.h"
 #include "utils.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sched.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SLABSHIFT 12        //slabs are 4 KiB buddy blocks, or the nearest order in [l, u]
+#define SLABBIT   0x80      //order map flag on a slab's first granule
+#define MAGIC     "BALLOCSH"  //first bytes of a shared pool's memory file
+#define DEFERBYTES (1 << 16)  //w/BALLOC_DEFER, bytes each level holds locally free before coalescing them, by default
+
+// Lock structure: one per level, padded to its own cache line so levels don't contend on it
+typedef struct {
+    pthread_mutex_t mutex;
+} __attribute__((aligned(64))) Lock;
+
+// Counters structure: one level's, or one slab class's, counts, padded like a lock so no two share a cache line
+// every call counts on the line of the size it hands out or gives back, so threads working at different sizes never touch the same one
+typedef struct {
+    size_t allocated;       //blocks of this size handed out and not yet freed; for a slab class, objects
+    size_t peak;            //most blocks of this size allocated at once
+    size_t requested;       //bytes asked for, by requests answered at this size
+    size_t granted;         //bytes handed out for them
+    size_t live;            //bytes handed out at this size and not yet freed
+    size_t failed;          //allocations at this size that returned NULL; ones too big for any block count at u
+    size_t splits;          //blocks of this size split in two
+    size_t merges;          //pairs of this size coalesced
+    size_t fails;           //allocations of this size that found no block
+    size_t local;           //w/BALLOC_DEFER, blocks on this level's deferred list, kept under the level's lock
+    size_t watermark;       //w/BALLOC_DEFER, most blocks this level defers before coalescing them all
+    size_t started;         //w/BALLOC_LOCKFREE, steps begun at this level that may hold free memory out of the lists
+    size_t settled;         //w/BALLOC_LOCKFREE, those steps ended
+} __attribute__((aligned(64))) Counters;
+
+// Total structure: bytes live across every size, on a line of its own, since every balloc and bfree writes it
+typedef struct {
+    size_t live;            //bytes handed out and not yet freed
+    size_t peak;            //most bytes live at once
+} __attribute__((aligned(64))) Total;
+
+// State structure: everything about a pool that changes as it is used, and isn't kept by a module
+// a shared pool keeps it in its region, so every process attached sees the same
+typedef struct {
+    size_t hwm;             //high-water mark, offset from base: memory from here to end of pool has never been on a free list
+    int purge_e;            //free blocks of 2^purge_e or more get their pages released to the OS
+    int decay_ms;           //0: purge when freed, >0: bfree trims at most once per decay_ms, <0: only btrim purges
+    long lasttrim;          //time of last decay trim, in ms
+    Counters counters[64];  //counts for each block size, indexed by e - l
+    Counters classes[SLABCLASSES];  //w/BALLOC_SLAB, counts for each slab class's objects
+    Total total;            //bytes live in the pool, unless it is a shard, which counts on its router's
+} State;
 
 // Pool structure: contains base address and size of mem. pool, min and max block sizes, arrays of free lists and buddy bitmaps for each level
+// fields every call reads come first, so they fill the structure's first two cache lines, and creation-time ones follow
 typedef struct {
     void *base;             //base address of mem. pool
     size_t size;            //total size of mem. pool
     int l, u;               //min exponent and max exponent of block sizes
-    FreeList *freelists;    //array of free lists, one for each block size
-    BBM *buddy_bitmaps;     //array of buddy bitmaps, one for each block size
-    BBM *alloc_bitmaps;     //array of allocation bitmaps, one for each block size, to track allocated blocks and their sizes
+    FreeList *freelists;    //array of free lists, one for each block size, NULL w/BALLOC_TREE
+    FreeList *deferred;     //w/BALLOC_DEFER, lists of locally free blocks, which their buddy bits count as allocated
+    BBM *buddy_bitmaps;     //array of buddy bitmaps, one for each block size, NULL w/BALLOC_TREE
+    Tree tree;              //free-space tree, replaces free lists and buddy bitmaps, NULL unless BALLOC_TREE
+    LFList lflists;         //lock-free free lists, replace free lists and buddy bitmaps, NULL unless BALLOC_LOCKFREE
+    unsigned char *orders;  //order map, one byte per 2^l granule: exponent of the allocated block starting there, 0 if none
+    Lock *locks;            //array of locks, one for each block size, NULL unless BALLOC_THREADSAFE
+                            //w/BALLOC_TREE only the first is used, for the whole tree
+                            //w/BALLOC_LOCKFREE none is, the lock-free lists need none
+                            //w/BALLOC_SLAB one more follows for each slab class
+    Slabs slabs;            //slab layout and lists of slabs w/room, NULL unless BALLOC_SLAB
+    int slab_e;             //slabs are 2^slab_e byte blocks
+    BM dirty;               //one bit per page, set once an owner may have written to it, cleared when purged
+    int pageshift;          //log2 of page size
+    State *state;           //the state in meta or region, or in the router w/BALLOC_PERCPU
+    Total *total;           //the state's total, or w/a shard, the router's
+    void *meta;             //mapping of header, this structure and every module's metadata, NULL unless private
+    void *region;           //w/BALLOC_SHARED or bload, mapping of header, metadata and pool, NULL otherwise
+    size_t length;          //bytes of meta, or of region before base
+    int fd;                 //w/BALLOC_SHARED, memory file backing region, -1 otherwise
+    Balloc *shards;         //w/BALLOC_PERCPU, one pool per shard, each on its own slice of base, NULL otherwise
+                            //the pool itself only routes calls to them, and owns the reservation
+    int nshards;
+    size_t stride;          //bytes from one shard's slice to the next, a multiple of 2^u
+    int slice;              //1 if base is a slice of a per-CPU pool's reservation, which that pool frees
 } Pool;
 
-/*  (1) create pool structure
-    (2) allocate main memory pool using mmalloc
-    (3) create free lists and buddy bitmaps for each level, and initialize them
-    (4) add initial blocks to free lists, starting with largest blocks working down
+// Router structure: a per-CPU pool, the one kind w/neither meta nor region, so its state follows it
+typedef struct {
+    Pool pool;
+    State state;
+} Router;
+
+//lock level e's free list and buddy bitmap, if pool is thread-safe, or the whole tree
+static void lock(Pool *pool, int e){
+    if (pool->locks && !pool->lflists)
+        pthread_mutex_lock(&pool->locks[pool->tree ? 0 : e - pool->l].mutex);
+}
+
+//unlock level e, if pool is thread-safe
+static void unlock(Pool *pool, int e){
+    if (pool->locks && !pool->lflists)
+        pthread_mutex_unlock(&pool->locks[pool->tree ? 0 : e - pool->l].mutex);
+}
+
+//number of locks a thread-safe pool has
+static int lockcount(Pool *pool){
+    return pool->u - pool->l + 1 + (pool->slabs ? SLABCLASSES : 0);
+}
+
+//lock slab class c, if pool is thread-safe; class locks are taken before any level lock
+static void slablock(Pool *pool, int c){
+    if (pool->locks)
+        pthread_mutex_lock(&pool->locks[pool->u - pool->l + 1 + c].mutex);
+}
+
+//unlock slab class c, if pool is thread-safe
+static void slabunlock(Pool *pool, int c){
+    if (pool->locks)
+        pthread_mutex_unlock(&pool->locks[pool->u - pool->l + 1 + c].mutex);
+}
+
+/*  (1) add n, which may be negative, to counter c
+    (2) w/locks, other threads may be counting too, so use a relaxed atomic, which orders nothing
+    (3) return counter's new value
+*/
+static size_t count(Pool *pool, size_t *c, long n){
+    if (pool->locks)
+        return __atomic_add_fetch(c, n, __ATOMIC_RELAXED);
+    return *c += n;
+}
+
+//raise high-water mark *peak to v, if v is higher
+static void highwater(Pool *pool, size_t *peak, size_t v){
+    size_t old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (v > old){
+        if (!pool->locks){
+            *peak = v;
+            return;
+        }
+        if (__atomic_compare_exchange_n(peak, &old, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return;
+    }
+}
+
+//count n more (or w/n < 0, fewer) blocks of 2^e allocated
+static void tally(Pool *pool, int e, long n){
+    Counters *c = &pool->state->counters[e - pool->l];
+    size_t now = count(pool, &c->allocated, n);
+    if (n > 0)
+        highwater(pool, &c->peak, now);
+}
+
+//counters of level e, or of level u for a request too big for any block, e < 0
+static Counters *counters(Pool *pool, int e){
+    return &pool->state->counters[(e < 0 ? pool->u : e) - pool->l];
+}
+
+/*  (1) w/lock-free lists, count the start or end of a step that takes free memory out of the lists for a while:
+        a block popped to be split, a merge, a trim, or a resize
+    (2) sequentially consistent, so a thread that finds every list empty, and then no other step in flight
+        or ended since it looked, knows the memory really is all handed out
+*/
+static void begin(Pool *p, int e){
+    if (p->lflists)
+        __atomic_add_fetch(&counters(p, e)->started, 1, __ATOMIC_SEQ_CST);
+}
+
+static void end(Pool *p, int e){
+    if (p->lflists)
+        __atomic_add_fetch(&counters(p, e)->settled, 1, __ATOMIC_SEQ_CST);
+}
+
+//steps ended at every level so far
+static size_t settled(Pool *p){
+    size_t n = 0;
+    for (int e = p->l; e <= p->u; e++)
+        n += __atomic_load_n(&counters(p, e)->settled, __ATOMIC_SEQ_CST);
+    return n;
+}
+
+/*  (1) read the steps ended, then the steps begun, so a step in flight during both reads is counted begun and not ended
+    (2) return 1 if a step other than the caller's own is in flight, or one ended since seen was read
+*/
+static int moving(Pool *p, size_t seen){
+    size_t done = settled(p), started = 0;
+    for (int e = p->l; e <= p->u; e++)
+        started += __atomic_load_n(&counters(p, e)->started, __ATOMIC_SEQ_CST);
+    return started - done != 1 || done != seen;
+}
+
+//count n more (or w/n < 0, fewer) bytes live on c, and in the whole pool, whose peak only a rise can move
+static void charge(Pool *pool, Counters *c, long n){
+    count(pool, &c->live, n);
+    size_t now = count(pool, &pool->total->live, n);
+    if (n > 0)
+        highwater(pool, &pool->total->peak, now);
+}
+
+//count a request for size bytes on c, answered w/granted bytes, or a failure if granted is 0
+static void handout(Pool *pool, Counters *c, size_t size, size_t granted){
+    if (granted == 0){
+        count(pool, &c->failed, 1);
+        return;
+    }
+    count(pool, &c->requested, size);
+    count(pool, &c->granted, granted);
+    charge(pool, c, granted);
+}
+
+//count size bytes given back on c
+static void giveback(Pool *pool, Counters *c, size_t size){
+    charge(pool, c, -(long)size);
+}
+
+/*  (1) flip buddy bit for the pair containing mem at level e
+    (2) the bit is 1 exactly when one block of the pair is on level e's free list
+*/
+static void toggle(Pool *pool, void *mem, int e){
+    bbmflip(pool->buddy_bitmaps[e - pool->l], pool->base, mem, e);
+}
+
+//add block to level e's free list, keeping its buddy bit in step
+//every block pushed is the upper part of one the caller holds, so w/lock-free lists its buddy is never free to merge
+static void push(Pool *pool, void *mem, int e){
+    if (pool->lflists){
+        lflistfree(pool->lflists, pool->base, mem, e);
+        return;
+    }
+    freelistfree(pool->freelists, pool->base, mem, e, pool->l);
+    toggle(pool, mem, e);
+}
+
+//take any block from level e's free list, or NULL if empty; w/a tree, the lowest free 2^e block
+//w/deferred lists, a locally free block first, whose buddy bit already counts it as allocated
+static void *pop(Pool *pool, int e){
+    if (pool->tree){
+        int from;
+        long offset = treealloc(pool->tree, e, &from);
+        if (offset < 0)
+            return NULL;
+        //one split at each order the tree cut the block down through
+        for (int k = e + 1; k <= from; k++)
+            count(pool, &pool->state->counters[k - pool->l].splits, 1);
+        return pool->base + offset;
+    }
+    if (pool->lflists)
+        return lflistalloc(pool->lflists, pool->base, e);
+    if (pool->deferred){
+        void *mem = freelistalloc(pool->deferred, pool->base, e, pool->l);
+        if (mem){
+            pool->state->counters[e - pool->l].local--;
+            return mem;
+        }
+    }
+    void *mem = freelistalloc(pool->freelists, pool->base, e, pool->l);
+    if (mem)
+        toggle(pool, mem, e);
+    return mem;
+}
+
+//take a known-free block out of the middle of level e's free list
+static void unlink_block(Pool *pool, void *mem, int e){
+    freelistremove(pool->freelists, pool->base, mem, e, pool->l);
+    toggle(pool, mem, e);
+}
+
+/*  (1) find the granule mem starts in, rejecting pointers that are not granule-aligned
+    (2) return exponent of the allocated block at mem, or 0 if none starts there, or a slab does
+*/
+static int blockorder(Pool *pool, void *mem){
+    size_t offset = mem - pool->base;
+    if (offset & (e2size(pool->l) - 1))
+        return 0;
+    int e = __atomic_load_n(&pool->orders[offset >> pool->l], __ATOMIC_RELAXED);
+    return e & SLABBIT ? 0 : e;
+}
+
+//record (or with e = 0, erase) the exponent of the block at mem
+//order map bytes are read w/o locks, by bsize and by slabof for blocks near a slab boundary
+static void setorder(Pool *pool, void *mem, int e){
+    __atomic_store_n(&pool->orders[(size_t)(mem - pool->base) >> pool->l], e, __ATOMIC_RELAXED);
+}
+
+/*  (1) find the 2^slab_e block mem falls in
+    (2) return it if the order map says it is a slab, or NULL
+*/
+static void *slabof(Pool *pool, void *mem){
+    if (!pool->slabs)
+        return NULL;
+    size_t offset = (size_t)(mem - pool->base) & ~(e2size(pool->slab_e) - 1);
+    unsigned char e = __atomic_load_n(&pool->orders[offset >> pool->l], __ATOMIC_RELAXED);
+    return e & SLABBIT ? pool->base + offset : NULL;
+}
+
+//mark every page of [mem, mem+size) dirty, its new owner may write to any of them
+static void markdirty(Pool *pool, void *mem, size_t size){
+    size_t offset = mem - pool->base;
+    size_t first = offset >> pool->pageshift;
+    size_t last = (offset + size - 1) >> pool->pageshift;
+    bmsetrange(pool->dirty, first, last - first + 1);
+}
+
+/*  (1) zero each run of dirty pages in [mem, mem+size) of a block just taken off the free lists
+    (2) clean pages are still zero: fresh from mmap, or purged w/MADV_DONTNEED, and free-list links
+        are cleared as blocks leave the lists, so no stale bytes hide on them
+*/
+static void clean(Pool *pool, void *mem, size_t size){
+    size_t offset = mem - pool->base;
+    size_t end = ((offset + size - 1) >> pool->pageshift) + 1;
+
+    for (size_t page = bmffs(pool->dirty, offset >> pool->pageshift, end); page < end; ){
+        size_t run = bmffc(pool->dirty, page, end);
+        void *from = pool->base + (page << pool->pageshift);
+        void *to = pool->base + (run << pool->pageshift);
+        if (from < mem)
+            from = mem;
+        if (to > mem + size)
+            to = mem + size;
+        memset(from, 0, to - from);
+        page = bmffs(pool->dirty, run, end);
+    }
+}
+
+/*  (1) give len bytes of pages at mem back to the OS, so they read back as zero
+        MADV_DONTNEED, not MADV_FREE, so the zeros are certain
+        w/a shared pool, MADV_REMOVE, as MADV_DONTNEED leaves the memory file holding the pages
+        w/a pool bload mapped from a snapshot, fresh anonymous pages over them, as MADV_DONTNEED
+        would bring back the snapshot's
+*/
+static void release(Pool *pool, void *mem, size_t len){
+    if (!pool->region)
+        madvise(mem, len, MADV_DONTNEED);
+    else if (pool->fd >= 0)
+        madvise(mem, len, MADV_REMOVE);
+    else
+        mmap(mem, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+}
+
+/*  (1) skip free block's first page, which holds its free-list links, unless the pool keeps them out of band
+    (2) find each run of dirty pages in the rest of the block a word at a time,
+        release it, and mark it clean
+    (3) return number of bytes released
+*/
+static size_t purge(Pool *pool, void *mem, int e){
+    size_t offset = mem - pool->base;
+    size_t end = (offset + e2size(e)) >> pool->pageshift;
+    size_t released = 0;
+
+    size_t first = (offset >> pool->pageshift) + (pool->freelists ? 1 : 0);
+
+    for (size_t page = bmffs(pool->dirty, first, end); page < end; ){
+        size_t run = bmffc(pool->dirty, page, end);
+        bmclrrange(pool->dirty, page, run - page);
+        release(pool, pool->base + (page << pool->pageshift), (run - page) << pool->pageshift);
+        released += (run - page) << pool->pageshift;
+        page = bmffs(pool->dirty, run, end);
+    }
+    return released;
+}
+
+//coarse monotonic clock in ms, cheap enough to read on every bfree
+static long nowms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*  (1) if decay_ms has passed since the last trim, claim this trim w/compare-and-swap
+    (2) only the thread that wins runs btrim
+*/
+static void decay(Pool *pool){
+    long now = nowms();
+    long last = __atomic_load_n(&pool->state->lasttrim, __ATOMIC_RELAXED);
+    if (now - last < pool->state->decay_ms)
+        return;
+    if (__atomic_compare_exchange_n(&pool->state->lasttrim, &last, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        btrim(pool);
+}
+
+// Header structure: first bytes of a shared pool's region, so a process w/only its memory file can attach,
+// of a snapshot file, so bload can map it back, and of a private pool's metadata mapping
+// each module's metadata follows on cache lines of its own, then the pool, at offset length
+typedef struct {
+    char magic[8];
+    size_t size;            //total size of mem. pool
+    int l, u;               //min exponent and max exponent of block sizes
+    int flags;              //flags the pool was created w/
+    int slab_e;             //slabs are 2^slab_e byte blocks
+    size_t length;          //bytes of region before the pool, a whole number of pages
+    size_t pool;            //offset from region of the pool structure, and of the buddy bitmap handles,
+    size_t handles;         //which are only in the region of a private pool, 0 otherwise
+    size_t locks;           //offset from region of each module's handle, 0 if pool has none
+    size_t freelists;
+    size_t deferred;
+    size_t lflists;
+    size_t tree;
+    size_t orders;
+    size_t dirty;
+    size_t slabs;
+    size_t bitmaps[64];     //one for each block size, indexed by e - l
+    State state __attribute__((aligned(64)));
+} Header;
+
+/*  (1) fresh pages are all clean, by default only btrim purges, blocks of two pages or more
+        w/deferred lists, each level defers up to DEFERBYTES of blocks, or one block if that's smaller
+    (2) lazy pools touch nothing more, balloc carves blocks from the high-water mark as it needs them
+        tree pools are lazy by construction, and never carve
+    (3) otherwise add initial blocks to free lists, start with largest blocks working down
+    (4) return pointer to pool
+*/
+static Balloc start(Pool *pool, int flags){
+    State *state = pool->state;
+    state->purge_e = pool->pageshift + (pool->freelists ? 1 : 0);
+    state->decay_ms = -1;
+    state->lasttrim = nowms();
+    for (int e = pool->l; e <= pool->u && pool->deferred; e++){
+        state->counters[e - pool->l].watermark = e2size(e) < DEFERBYTES ? DEFERBYTES >> e : 1;
+    }
+
+    state->hwm = pool->tree ? pool->size : 0;
+    if (flags & (BALLOC_LAZY | BALLOC_TREE))
+        return pool;
+
+    size_t current = 0;
+    for (int e = pool->u; e >= pool->l; e--){
+        size_t blocksize = e2size(e);
+
+        //create as many block of this size as possible
+        while (pool->size - current >= blocksize){
+            push(pool, pool->base + current, e);
+            current += blocksize;
+        }
+    }
+    state->hwm = current;
+
+    return pool;
+}
+
+/*  (1) create pool structure for a mapped region, w/every module found at its offset in the header
+        a private pool's structure is in its metadata mapping, and its pool is at base, apart from it
+    (2) buddy bitmap handles go in the same place as the pool structure, as they are the one thing
+        a shared pool's other processes can't share
+    (3) return pointer to pool, or NULL on failure
+*/
+static Pool *attach(void *region, void *base, int fd){
+    Header *h = region;
+    Pool *pool = h->pool ? region + h->pool : mmalloc(sizeof(Pool));
+    if ((long)pool == -1)
+        return NULL;
+    *pool = (Pool){0};
+
+    if (h->pool)
+        pool->meta = region;
+    else
+        pool->region = region;
+    pool->length = h->length;
+    pool->fd = fd;
+    pool->base = base ? base : region + h->length;
+    pool->size = h->size;
+    pool->l = h->l;
+    pool->u = h->u;
+    pool->slab_e = h->slab_e;
+    pool->pageshift = size2e(sysconf(_SC_PAGESIZE));
+    pool->state = &h->state;
+    pool->total = &h->state.total;
+
+    if (h->locks)
+        pool->locks = region + h->locks;
+    pool->orders = region + h->orders;
+    pool->dirty = region + h->dirty;
+    if (h->tree)
+        pool->tree = region + h->tree;
+    if (h->slabs)
+        pool->slabs = region + h->slabs;
+    if (h->deferred)
+        pool->deferred = region + h->deferred;
+    if (h->lflists)
+        pool->lflists = region + h->lflists;
+    if (h->freelists){
+        pool->freelists = region + h->freelists;
+        pool->buddy_bitmaps = h->handles ? region + h->handles : mmalloc((h->u - h->l + 1) * sizeof(BBM));
+        if ((long)pool->buddy_bitmaps == -1){
+            mmfree(pool, sizeof(Pool));
+            return NULL;
+        }
+        for (int e = h->l; e <= h->u; e++){
+            pool->buddy_bitmaps[e - h->l] = region + h->bitmaps[e - h->l];
+        }
+    }
+    return pool;
+}
+
+/*  (1) place header, then locks and each module's metadata, then the pool, starting on a page,
+        for the pool h describes; the same layout serves shared pools, snapshots and private pools' metadata
+        w/private, the pool structure and buddy bitmap handles go right after the header, so the fields
+        every call reads share a few cache lines, next to the state
+    (2) put each piece's offset from the region in h, and the offset of the pool in h->length
+    (3) return 1, or 0 if the pool can't be laid out
+*/
+static int layout(Header *h, int private){
+    int l = h->l, u = h->u;
+    int levels = u - l + 1;
+    size_t at = sizeof(Header);
+
+    if (private)
+        at = place(at, sizeof(Pool), &h->pool);
+    if (private && !(h->flags & (BALLOC_TREE | BALLOC_LOCKFREE)))
+        at = place(at, levels * sizeof(BBM), &h->handles);
+    if (h->flags & BALLOC_SLAB)
+        h->slab_e = SLABSHIFT < l ? l : SLABSHIFT > u ? u : SLABSHIFT;
+    if (h->flags & BALLOC_THREADSAFE)
+        at = place(at, (levels + (h->flags & BALLOC_SLAB ? SLABCLASSES : 0)) * sizeof(Lock), &h->locks);
+    if (h->flags & BALLOC_TREE){
+        size_t bytes = treebytes(h->size, l, u);
+        if (!bytes)
+            return 0;
+        at = place(at, bytes, &h->tree);
+    } else if (h->flags & BALLOC_LOCKFREE){
+        size_t bytes = lflistbytes(h->size, l, u);
+        if (!bytes)
+            return 0;
+        at = place(at, bytes, &h->lflists);
+    } else {
+        if (levels > (int)(sizeof(unsigned long) * bitsperbyte))
+            return 0;
+        at = place(at, freelistbytes(l, u), &h->freelists);
+        if (h->flags & BALLOC_DEFER)
+            at = place(at, freelistbytes(l, u), &h->deferred);
+        for (int e = l; e <= u; e++){
+            at = place(at, bbmbytes(h->size, e), &h->bitmaps[e - l]);
+        }
+    }
+    int pageshift = size2e(sysconf(_SC_PAGESIZE));
+    at = place(at, divup(h->size, e2size(l)), &h->orders);
+    at = place(at, bmbytes(divup(h->size, e2size(pageshift))), &h->dirty);
+    if (h->flags & BALLOC_SLAB)
+        at = place(at, slabsbytes(), &h->slabs);
+    h->length = divup(at, e2size(pageshift)) << pageshift;
+    return 1;
+}
+
+/*  (1) have each module lay itself out in place, in a zeroed region whose header layout filled in
+    (2) replace each piece's offset w/the offset of the handle its module returns
+    (3) return nothing, locks are left for the caller to make
+*/
+static void lay(void *region){
+    Header *h = region;
+    int pageshift = size2e(sysconf(_SC_PAGESIZE));
+    if (h->tree)
+        h->tree = (void *)treeinit(region + h->tree, h->size, h->l, h->u) - region;
+    if (h->lflists)
+        h->lflists = (void *)lflistinit(region + h->lflists, h->size, h->l, h->u) - region;
+    if (h->freelists)
+        h->freelists = (void *)freelistinit(region + h->freelists, h->l, h->u) - region;
+    if (h->deferred)
+        h->deferred = (void *)freelistinit(region + h->deferred, h->l, h->u) - region;
+    for (int e = h->l; e <= h->u && h->freelists; e++){
+        h->bitmaps[e - h->l] = (void *)bbminit(region + h->bitmaps[e - h->l], h->size, e) - region;
+    }
+    h->dirty = (void *)bminit(region + h->dirty, divup(h->size, e2size(pageshift))) - region;
+    if (h->slabs)
+        h->slabs = (void *)slabsinit(region + h->slabs, h->slab_e) - region;
+}
+
+//make a region pool's locks, w/pshared PTHREAD_PROCESS_SHARED for ones other processes take too
+static void makelocks(Pool *pool, int pshared){
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, pshared);
+    for (int i = 0; pool->locks && i < lockcount(pool); i++){
+        pthread_mutex_init(&pool->locks[i].mutex, &attr);
+    }
+    pthread_mutexattr_destroy(&attr);
+}
+
+/*  (1) lay out the region, create a memory file that large, and map it so the pool is aligned to 2^u
+    (2) lay out each module in place, memory files start zeroed just like mmalloc memory
+    (3) find everything from the header, just as battach does
+    (4) make locks that work across processes, and start the pool
     (5) return pointer to pool, or NULL on failure
 */
-extern Balloc bcreate(unsigned int size, int l, int u){
-    Pool *pool = malloc(sizeof(Pool));
-    if (!pool)
+static Balloc sharedcreate(size_t size, int l, int u, int flags){
+    Header h = {0};
+    memcpy(h.magic, MAGIC, sizeof(h.magic));
+    h.size = size;
+    h.l = l;
+    h.u = u;
+    h.flags = flags;
+    if (!layout(&h, 0))
         return NULL;
 
-    //allocatie main memory pool
-    void *base = mmalloc(size);
-    if ((long)base == -1){
-        free(pool);
+    int fd = memfd_create("balloc", MFD_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    void *region = (void *)-1;
+    if (ftruncate(fd, h.length + size) == 0)
+        region = mmfile(fd, h.length + size, h.length, u, MAP_SHARED);
+    if ((long)region == -1){
+        close(fd);
         return NULL;
     }
+    *(Header *)region = h;
+    lay(region);
 
-    //initialize pool structure
-    pool->base = base;
-    pool->size = size;
-    pool->l = l;
-    pool->u = u;
+    Pool *pool = attach(region, NULL, fd);
+    if (!pool){
+        mmfree(region, h.length + size);
+        close(fd);
+        return NULL;
+    }
+    makelocks(pool, PTHREAD_PROCESS_SHARED);
+    return start(pool, flags);
+}
+
+/*  (1) read the header of a shared pool's memory file, and check it is one
+    (2) map the region, so the pool is 2^u-aligned here too, at whatever address it lands
+    (3) find everything in it, keeping a duplicate of fd, so the caller may close theirs
+    (4) return pointer to pool, or NULL on failure
+*/
+extern Balloc battach(int fd){
+    Header h;
+    if (pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || memcmp(h.magic, MAGIC, sizeof(h.magic)))
+        return NULL;
 
-    //create free lists
-    pool->freelists = freelistcreate(size, l, u);
-    if (!pool->freelists){
-        mmfree(base, size);
-        free(pool);
+    int own = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (own < 0)
+        return NULL;
+    void *region = mmfile(own, h.length + h.size, h.length, h.u, MAP_SHARED);
+    if ((long)region == -1){
+        close(own);
         return NULL;
     }
 
-    //create buddy bitmaps
-    int count = u - l + 1;
-    pool->buddy_bitmaps = malloc(count * sizeof(BBM));
-    if (!pool->buddy_bitmaps){
-        freelistdelete(pool->freelists, l, u);
-        mmfree(base, size);
-        free(pool);
+    Pool *pool = attach(region, NULL, own);
+    if (!pool){
+        mmfree(region, h.length + h.size);
+        close(own);
         return NULL;
     }
+    return pool;
+}
+
+//memory file behind a shared pool, for another process to battach, or -1 if pool isn't shared
+extern int bfd(Balloc pool){
+    Pool *p = pool;
+    return p->fd;
+}
+
+//write all n bytes at buf to fd at offset, retrying short writes; returns 0, or -1 on failure
+static int writeall(int fd, void *buf, size_t n, off_t offset){
+    while (n > 0){
+        ssize_t done = pwrite(fd, buf, n, offset);
+        if (done <= 0)
+            return -1;
+        buf += done;
+        n -= done;
+        offset += done;
+    }
+    return 0;
+}
 
-    pool->alloc_bitmaps = malloc(count * sizeof(BBM));
-    if (!pool->alloc_bitmaps){
-        free(pool->buddy_bitmaps);
-        freelistdelete(pool->freelists, l, u);
-        mmfree(base, size);
-        free(pool);
+/*  (1) lay out an image of the pool's metadata in memory, just like a shared pool's region
+    (2) copy state and each module's metadata into it; every link and handle in them is an offset,
+        so the image is the same wherever it is mapped
+    (3) mark the pages holding free-list links dirty in the image, so they are saved too,
+        and write the image, then only the dirty pages of the pool, leaving the rest a hole that reads back as zero
+    (4) write to path.tmp, sync it, and rename it over path, so path always holds a whole snapshot
+    (5) return 0, or -1 on failure
+    no thread may allocate or free while the pool is saved, blocks' contents are saved as they are
+    a pool w/lock-free lists can't be saved, the snapshot layout has no place for them, and nor can a per-CPU pool
+*/
+extern int bsave(Balloc pool, const char *path){
+    Pool *p = pool;
+    if (p->lflists || p->shards)
+        return -1;
+    Header h = {0};
+    memcpy(h.magic, MAGIC, sizeof(h.magic));
+    h.size = p->size;
+    h.l = p->l;
+    h.u = p->u;
+    h.flags = (p->locks ? BALLOC_THREADSAFE : 0) | (p->tree ? BALLOC_TREE : 0) | (p->slabs ? BALLOC_SLAB : 0) |
+              (p->deferred ? BALLOC_DEFER : 0);
+    if (!layout(&h, 0))
+        return -1;
+
+    void *image = mmalloc(h.length);
+    if ((long)image == -1)
+        return -1;
+    Header *header = image;
+    *header = h;
+    lay(image);
+    header->state = *p->state;
+
+    if (p->tree)
+        memcpy(image + header->tree, p->tree, treebytes(p->size, p->l, p->u));
+    if (p->freelists)
+        memcpy(image + header->freelists, p->freelists, freelistbytes(p->l, p->u));
+    if (p->deferred)
+        memcpy(image + header->deferred, p->deferred, freelistbytes(p->l, p->u));
+    for (int e = p->l; e <= p->u && p->freelists; e++){
+        bbmcopy(image + header->bitmaps[e - p->l], p->buddy_bitmaps[e - p->l]);
+    }
+    memcpy(image + header->orders, p->orders, divup(p->size, e2size(p->l)));
+    if (p->slabs)
+        memcpy(image + header->slabs, p->slabs, slabsbytes());
+
+    BM dirty = image + header->dirty;
+    bmcopy(dirty, p->dirty);
+    for (int e = p->l; e <= p->u && p->freelists; e++){
+        void *mem = freelistfirst(p->freelists, p->base, e, p->l);
+        for (; mem != NULL; mem = freelistnext(p->freelists, p->base, mem))
+            bmset(dirty, (size_t)(mem - p->base) >> p->pageshift);
+        mem = p->deferred ? freelistfirst(p->deferred, p->base, e, p->l) : NULL;
+        for (; mem != NULL; mem = freelistnext(p->deferred, p->base, mem))
+            bmset(dirty, (size_t)(mem - p->base) >> p->pageshift);
+    }
+
+    char tmp[PATH_MAX];
+    int rc = -1;
+    int fd = -1;
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) < (int)sizeof(tmp))
+        fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0 && ftruncate(fd, h.length + p->size) == 0 && writeall(fd, image, h.length, 0) == 0){
+        size_t pages = divup(p->size, e2size(p->pageshift));
+        rc = 0;
+        for (size_t page = bmffs(dirty, 0, pages); page < pages && rc == 0; ){
+            size_t run = bmffc(dirty, page, pages);
+            size_t from = page << p->pageshift;
+            size_t to = run << p->pageshift < p->size ? run << p->pageshift : p->size;
+            rc = writeall(fd, p->base + from, to - from, h.length + from);
+            page = bmffs(dirty, run, pages);
+        }
+        if (rc == 0)
+            rc = fsync(fd);
+    }
+    if (fd >= 0)
+        close(fd);
+    if (rc == 0)
+        rc = rename(tmp, path);
+    else if (fd >= 0)
+        unlink(tmp);
+
+    mmfree(image, h.length);
+    return rc;
+}
+
+/*  (1) read a snapshot's header, and check it is one, and whole
+    (2) map the file copy-on-write, so the pool is 2^u-aligned, and pages come in from the file only as they are touched
+        the file is left as it was, and the pool is private to this process
+    (3) find everything in it, just as battach does, and make fresh locks
+    (4) restart the decay clock, the saved one counted from another boot, maybe
+    (5) return pointer to pool, or NULL on failure
+*/
+extern Balloc bload(const char *path){
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    Header h;
+    struct stat st;
+    void *region = (void *)-1;
+    if (pread(fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h) && !memcmp(h.magic, MAGIC, sizeof(h.magic)) &&
+        fstat(fd, &st) == 0 && (size_t)st.st_size == h.length + h.size)
+        region = mmfile(fd, h.length + h.size, h.length, h.u, MAP_PRIVATE);
+    close(fd);
+    if ((long)region == -1)
+        return NULL;
+
+    Pool *pool = attach(region, NULL, -1);
+    if (!pool){
+        mmfree(region, h.length + h.size);
         return NULL;
     }
+    makelocks(pool, PTHREAD_PROCESS_PRIVATE);
+    pool->state->lasttrim = nowms();
+    return pool;
+}
 
-    //initialize each bitmap
-    for (int e = l; e < u; e++){
-        int index = e - l;
-        pool->buddy_bitmaps[index] = bbmcreate(size, e);
-        pool->alloc_bitmaps[index] = bbmcreate(size, e);
-        if (!pool->buddy_bitmaps[index] || !pool->alloc_bitmaps[index]){
-            //clean up previously created bitmaps
-            for (int j = 0; j < index; j++){
-                if(pool->buddy_bitmaps[j])
-                    bbmdelete(pool->buddy_bitmaps[j]);
-                if(pool->alloc_bitmaps[j])
-                    bbmdelete(pool->alloc_bitmaps[j]);
-            }
-            free(pool->alloc_bitmaps);
-            free(pool->buddy_bitmaps);
-            freelistdelete(pool->freelists, l, u);
+//flags a pool is created w/, once each adds what it implies, or -1 if no pool can have them w/blocks of 2^l to 2^u
+static int checkflags(int l, int u, int flags){
+    //the order map records 0 for a granule w/no block, so no block can be 2^0
+    //free blocks must be big enough to hold their free-list links, unless they're kept in a tree, or out of band
+    if (l < 1 || l > u || (!(flags & (BALLOC_TREE | BALLOC_LOCKFREE)) && e2size(l) < 2 * sizeof(void *)))
+        return -1;
+
+    //lock-free lists replace both the tree and the locked lists, and other processes can't find them, or shards
+    if ((flags & BALLOC_LOCKFREE) && (flags & (BALLOC_TREE | BALLOC_SHARED)))
+        return -1;
+    if ((flags & BALLOC_PERCPU) && (flags & BALLOC_SHARED))
+        return -1;
+
+    //deferring is for free lists that coalesce under locks, a tree or lock-free lists can't hold a block back from its buddy
+    if ((flags & BALLOC_DEFER) && (flags & (BALLOC_TREE | BALLOC_LOCKFREE)))
+        return -1;
+
+    //other processes are just more threads, and so are threads that move between CPUs
+    if (flags & (BALLOC_LOCKFREE | BALLOC_SHARED | BALLOC_PERCPU))
+        flags |= BALLOC_THREADSAFE;
+    return flags;
+}
+
+/*  (1) lay out every piece of the pool's metadata, the pool structure among it, in one mapping, from size, l, u and flags:
+        free lists and buddy bitmaps for each level, or w/BALLOC_TREE the free-space tree,
+        or w/BALLOC_LOCKFREE lock-free free lists, which need no buddy bitmaps,
+        then the order map, dirty bits, w/BALLOC_SLAB the slab layout, and w/BALLOC_THREADSAFE one lock per level and slab class
+    (2) allocate main memory pool using mmalign, aligned to the largest block size,
+        or w/slice, use the 2^u-aligned slice of a per-CPU pool's reservation there
+    (3) map the metadata, have each module lay itself out in it, and find everything, as for a shared pool
+        mmalloc memory starts zeroed, so only pieces that are touched get backed
+    (4) add initial blocks to free lists, unless BALLOC_LAZY
+    (5) return pointer to pool, or NULL on failure
+*/
+static Balloc create(size_t size, int l, int u, int flags, void *slice){
+    Header h = {0};
+    h.size = size;
+    h.l = l;
+    h.u = u;
+    h.flags = flags;
+    if (!layout(&h, 1))
+        return NULL;
+
+    //allocatie main memory pool, aligned to 2^u so every 2^e block is 2^e-aligned in memory too
+    void *base = slice ? slice : mmalign(size, u);
+    if ((long)base == -1)
+        return NULL;
+
+    //pool metadata comes from mmalloc, so an interposed malloc can build pools
+    void *meta = mmalloc(h.length);
+    if ((long)meta == -1){
+        if (!slice)
             mmfree(base, size);
-            free(pool);
-            return NULL;
-        }
+        return NULL;
     }
+    *(Header *)meta = h;
+    lay(meta);
 
-    //intalize the pool, start with largest blocks working down
-    void *current = base;
-    size_t remaining = size;
+    Pool *pool = attach(meta, base, -1);
+    pool->slice = slice != NULL;
+    makelocks(pool, PTHREAD_PROCESS_PRIVATE);
+    return start(pool, flags);
+}
 
-    for (int e = u; e >= l && remaining > 0; e--){
-        size_t blocksize = e2size(e);
+/*  (1) check flags, and add what they imply
+    (2) create a pool, in one memory file w/BALLOC_SHARED, or as one sub-pool per CPU w/BALLOC_PERCPU
+    (3) return pointer to pool, or NULL on failure
+*/
+extern Balloc bcreatef(size_t size, int l, int u, int flags){
+    flags = checkflags(l, u, flags);
+    if (flags < 0)
+        return NULL;
+    if (flags & BALLOC_SHARED)
+        return sharedcreate(size, l, u, flags);
+    if (flags & BALLOC_PERCPU)
+        return bcreateshards(size, l, u, flags, 0);
+    return create(size, l, u, flags, NULL);
+}
 
-        //create as many block of this size as possible
-        while (remaining >= blocksize){
-            freelistfree(pool->freelists, base, current, e, l);
-            current += blocksize;
-            remaining -= blocksize;
-        }
+/*  (1) split size into shards equal shares, rounded down to whole 2^l granules, one shard per CPU if shards <= 0
+    (2) reserve one 2^u-aligned region, w/each share on a slice starting at a multiple of 2^u,
+        so each shard's blocks are aligned to their size, and the shard owning an address is one division away
+    (3) build a thread-safe pool on each slice, w/the rest of flags; this pool only routes calls to them
+    (4) return pointer to pool, or NULL on failure
+*/
+extern Balloc bcreateshards(size_t size, int l, int u, int flags, int shards){
+    flags = checkflags(l, u, flags | BALLOC_PERCPU);
+    if (flags < 0)
+        return NULL;
+    if (shards <= 0)
+        shards = sysconf(_SC_NPROCESSORS_CONF);
+    if (shards <= 0)
+        shards = 1;
+    size_t share = size / shards & ~(e2size(l) - 1);
+    if (share == 0)
+        return NULL;
+
+    Router *router = mmalloc(sizeof(Router));
+    if ((long)router == -1)
+        return NULL;
+    Pool *pool = &router->pool;
+    pool->state = &router->state;
+    pool->total = &router->state.total;
+    pool->fd = -1;
+    pool->l = l;
+    pool->u = u;
+    pool->pageshift = size2e(sysconf(_SC_PAGESIZE));
+    pool->stride = divup(share, e2size(u)) << u;
+    pool->size = shards * pool->stride;
+
+    void *base = mmalign(pool->size, u);
+    pool->shards = mmalloc(shards * sizeof(Balloc));
+    if ((long)base == -1 || (long)pool->shards == -1){
+        if ((long)base != -1)
+            mmfree(base, pool->size);
+        if ((long)pool->shards != -1)
+            mmfree(pool->shards, shards * sizeof(Balloc));
+        mmfree(router, sizeof(Router));
+        return NULL;
     }
+    pool->base = base;
+    pool->nshards = shards;
 
+    for (int i = 0; i < shards; i++){
+        pool->shards[i] = create(share, l, u, flags & ~BALLOC_PERCPU, base + i * pool->stride);
+        if (!pool->shards[i]){
+            bdelete(pool);
+            return NULL;
+        }
+        ((Pool *)pool->shards[i])->total = pool->total;
+    }
     return pool;
-    
 }
 
-/*  (1) free all memory associated w/pool, including bitmaps, free lists, and mem. pool itself
-    (2) return nothing
+/*  (1) create a single-threaded pool
+    (2) return pointer to pool, or NULL on failure
+*/
+extern Balloc bcreate(size_t size, int l, int u){
+    return bcreatef(size, l, u, 0);
+}
+
+/*  (1) free all memory associated w/pool: its metadata mapping, which holds the pool structure too, and mem. pool itself
+        w/BALLOC_SHARED, just unmap this process's view of it, the memory file goes once every process has
+        w/BALLOC_PERCPU, delete each shard first, then the reservation they were slices of
+    (2) skip anything a failed bcreateshards never got to create
+    (3) return nothing
 */
 extern void   bdelete(Balloc pool){
     Pool *p = pool;
 
-    //free bitmaps and free lists
-    for (int e = p->l; e <= p->u; e++){
-            bbmdelete(p->buddy_bitmaps[e - p->l]);
-            bbmdelete(p->alloc_bitmaps[e - p->l]);
+    //a per-CPU pool deletes its shards, which leave their slices to it, then frees the reservation and itself
+    if (p->shards){
+        for (int i = 0; i < p->nshards && p->shards[i]; i++){
+            bdelete(p->shards[i]);
+        }
+        mmfree(p->shards, p->nshards * sizeof(Balloc));
+        if (p->base)
+            mmfree(p->base, p->size);
+        mmfree(p, sizeof(Router));
+        return;
+    }
+
+    //a shared pool lives in its region, where other processes may still hold its locks
+    if (p->region){
+        if (p->buddy_bitmaps)
+            mmfree(p->buddy_bitmaps, (p->u - p->l + 1) * sizeof(BBM));
+        mmfree(p->region, p->length + p->size);
+        if (p->fd >= 0)
+            close(p->fd);
+        mmfree(p, sizeof(Pool));
+        return;
+    }
+
+    //free main pool, unless it is a per-CPU pool's slice
+    if (p->base && !p->slice)
+        mmfree(p->base, p->size);
+
+    //free locks, then the metadata, and the pool structure along w/it
+    if (p->meta){
+        for (int i = 0; p->locks && i < lockcount(p); i++){
+            pthread_mutex_destroy(&p->locks[i].mutex);
+        }
+        mmfree(p->meta, p->length);
+        return;
     }
-    free(p->alloc_bitmaps);
-    free(p->buddy_bitmaps);
+    mmfree(p, sizeof(Pool));
+}
 
-    //free lists
-    freelistdelete(p->freelists, p->l, p->u);
+/*  (1) find the largest block that fits above the high-water mark, the same block eager init puts there
+    (2) if it is at least 2^e, move the mark past it and return it, w/its exponent in *k
+    (3) otherwise return NULL, since every block left above the mark is smaller still
+    w/lock-free lists, threads carve at once, so the mark moves w/compare-and-swap, and a thread that loses tries again
+*/
+static void *carve(Pool *pool, int e, int *k){
+    size_t hwm = __atomic_load_n(&pool->state->hwm, __ATOMIC_RELAXED);
+    int c;
+    do {
+        size_t remaining = pool->size - hwm;
+        if (remaining < e2size(e))
+            return NULL;
 
-    //free main pool
-    mmfree(p->base, p->size);
+        //largest c w/2^c <= remaining, capped at u
+        c = size2e(remaining + 1) - 1;
+        if (c > pool->u)
+            c = pool->u;
 
-    //free pool structure
-    free(p);
+        //bstats reads the mark w/o locks
+        if (!pool->lflists){
+            __atomic_store_n(&pool->state->hwm, hwm + e2size(c), __ATOMIC_RELAXED);
+            break;
+        }
+    } while (!__atomic_compare_exchange_n(&pool->state->hwm, &hwm, hwm + e2size(c), 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    *k = c;
+    return pool->base + hwm;
 }
 
 static void split_block(Pool *pool, void *mem, int e){
@@ -144,79 +1019,517 @@ static void split_block(Pool *pool, void *mem, int e){
     void *buddy = mem + e2size(e_new);
 
     //add upper buddy to free list for e_new
-    freelistfree(pool->freelists, pool->base, buddy, e_new, pool->l);
+    push(pool, buddy, e_new);
+    count(pool, &pool->state->counters[e - pool->l].splits, 1);
+}
+
+/*  (1) free block of 2^e at mem, coalescing it w/its free buddies, hand over hand up the levels
+        w/a tree, in one walk up the tree from the block's node
+    (2) purge it, if the purge policy says to
+    (3) return nothing
+*/
+static void coalesce(Pool *p, void *mem, int e){
+    lock(p, e);
+    if (p->tree){
+        //the tree coalesces as it marks the block free, and reports the free block it ended up in
+        int from = e;
+        e = treefree(p->tree, mem - p->base, e);
+        mem = p->base + ((size_t)(mem - p->base) & ~(e2size(e) - 1));
+        for (int k = from; k < e; k++)
+            count(p, &p->state->counters[k - p->l].merges, 1);
+    } else {
+        //try to coalesce with buddy
+        while (e < p->u){
+            int index = e - p->l;
+
+            //buddy bit is 1 only when the buddy is free at this level, since mem is not
+            if (!bbmtst(p->buddy_bitmaps[index], p->base, mem, e))
+                break;
+
+            //buddy is free, coalesce
+            void *buddy = baddrinv(p->base, mem, e);
+            unlink_block(p, buddy, e);
+            count(p, &p->state->counters[index].merges, 1);
+
+            if (buddy < mem){
+                mem = buddy; //lower address becomes new block
+            }
+
+            //move to next
+            lock(p, e + 1);
+            unlock(p, e);
+            e++;
+        }
+
+        //add block to free list for final level
+        push(p, mem, e);
+    }
+    if (p->state->decay_ms == 0 && e >= p->state->purge_e)
+        purge(p, mem, e);
+    unlock(p, e);
 }
 
-/*  (1) convert size to exponent e 
-    (2) find smallest free list w/available block of size 2^e
-    (3) if found at level K where k < e: 
+/*  (1) take each block off level e's deferred list, one at a time under the level's lock
+    (2) free it for real, coalescing it w/its buddies, which its own buddy bit now lets it
+    (3) return number of blocks coalesced
+    levels are flushed from the bottom up by flush, so blocks merged up meet the deferred blocks above them
+*/
+static size_t flushlevel(Pool *p, int e){
+    size_t n = 0;
+    for (;;){
+        lock(p, e);
+        void *mem = freelistalloc(p->deferred, p->base, e, p->l);
+        if (mem)
+            p->state->counters[e - p->l].local--;
+        unlock(p, e);
+        if (mem == NULL)
+            return n;
+        coalesce(p, mem, e);
+        n++;
+    }
+}
+
+//coalesce every deferred block, from level l up, and return how many there were
+static size_t flush(Pool *p){
+    size_t n = 0;
+    for (int e = p->l; e <= p->u; e++)
+        n += flushlevel(p, e);
+    return n;
+}
+
+/*  (1) put block of 2^e at mem on level e's deferred list, leaving its buddy bit as it is, unless the level is at its watermark
+    (2) at the watermark, coalesce every block the level deferred, as one batch
+    (3) return 1 if mem was deferred, or 0 if the caller must free it for real
+*/
+static int defer(Pool *p, void *mem, int e){
+    if (!p->deferred)
+        return 0;
+    int index = e - p->l;
+    lock(p, e);
+    int deferred = p->state->counters[index].local < p->state->counters[index].watermark;
+    if (deferred){
+        freelistfree(p->deferred, p->base, mem, e, p->l);
+        p->state->counters[index].local++;
+    }
+    unlock(p, e);
+    if (!deferred)
+        flushlevel(p, e);
+    return deferred;
+}
+
+/*  (1) pop a block from the smallest non-empty level at or above e, caller already holds level e's lock
+    (2) w/locks, the mask is only a hint while other threads run, so lock and check each level above e
+        in turn, leaving e..*held locked for the caller's split
+    (3) w/lock-free lists, pop each level from e up in turn, w/no locks, inside a step the caller began at e
+        a level may gain a block just after it is passed over, so on a miss, look again while another thread's
+        step is in flight, or ended since the first look, and only fail once no step could have hidden a block
+    (4) if every list is empty, carve a block from above the high-water mark; w/locks all of e..u are held by then
+    (5) return block w/its exponent in *k, or NULL
+*/
+static void *take(Pool *p, int e, int *k, int *held){
+    void *block;
+    *held = e;
+    if (p->tree){
+        //one walk down the tree finds the block, already the right size
+        *k = e;
+        return pop(p, e);
+    }
+    if (p->lflists){
+        for (;;){
+            size_t seen = settled(p);
+            for (*k = e; (block = pop(p, *k)) == NULL && *k < p->u; )
+                ++*k;
+            if (block || (block = carve(p, e, k)) != NULL || !moving(p, seen))
+                return block;
+        }
+    } else if (p->locks){
+        for (*k = e; (block = pop(p, *k)) == NULL && *k < p->u; )
+            lock(p, *held = ++*k);
+    } else {
+        //find smallest non-empty level at or above e in one step, counting deferred lists too
+        *k = freelistfind(p->freelists, e, p->l);
+        int d = p->deferred ? freelistfind(p->deferred, e, p->l) : -1;
+        if (d >= 0 && (*k < 0 || d < *k))
+            *k = d;
+        block = *k < 0 ? NULL : pop(p, *k);
+    }
+
+    if (block == NULL)
+        block = carve(p, e, k);
+    return block;
+}
+
+//exponent of the block balloc hands out for size, or -1 if no block can hold it
+static int sizeorder(Pool *p, size_t size){
+    if (size == 0 || size > p->size)
+        return -1;
+    int e = size2e(size);
+    if (e < p->l)
+        e = p->l;
+    return e > p->u ? -1 : e;
+}
+
+/*  (1) find smallest free list w/available block of size 2^e, using free lists' non-empty mask
+    (2) if found at level K where k < e: 
         remove block from list[k]
         split k times: k->k-1..->e, adding buddies to free lists as you go and setting buddy bits in bitmaps
         for each split, put one buddy in appropriate free list
-    (4) mark block as allocated in bitmap and return pointer to block
-    (5) return NULL if no block is available
+    (3) if no list has one, carve a block from above the high-water mark
+        and if that fails too, coalesce every deferred block, and try again if there were any
+    (4) if asked to, zero the first zero bytes of the block, but only on pages marked dirty
+    (5) record block's exponent in order map, mark its pages dirty, and return pointer to block
+    (6) return NULL if no block is available
+    locking: levels are always locked in ascending order, and every level from e to k
+    stays locked until the split is done, since the split pushes onto each of them
 */
-extern void *balloc(Balloc pool, unsigned int size){
+static void *blockalloc(Pool *p, int e, size_t zero){
+    int k, held;
+    void *block;
+    do {
+        lock(p, e);
+        begin(p, e);
+        block = take(p, e, &k, &held);
+
+        //split blocks down to desired level
+        while (block && k > e){
+            k--;
+            split_block(p, block, k + 1);
+        }
+        end(p, e);
+
+        for (int j = e; j <= held; j++)
+            unlock(p, j);
+    } while (block == NULL && p->deferred && flush(p));
+
+    if (block == NULL){
+        count(p, &p->state->counters[e - p->l].fails, 1);
+        return NULL;  //no free block found  
+    }
+    tally(p, e, 1);
+
+    if (zero)
+        clean(p, block, zero);
+
+    //record this block's size in the order map
+    setorder(p, block, e);
+    markdirty(p, block, e2size(e));
+
+    return block;
+    
+}
+
+/*  (1) take an object from a slab of class c w/room
+    (2) if there is none, allocate a 2^slab_e block, flag it as a slab in the order map, and lay it out
+    (3) return pointer to object, or NULL if the pool has no room for another slab
+    locking: class c stays locked while a new slab is allocated, so only one thread adds it
+*/
+static void *objectalloc(Pool *p, int c){
+    slablock(p, c);
+    void *mem = slaballoc(p->slabs, p->base, c);
+    if (mem == NULL){
+        void *slab = blockalloc(p, p->slab_e, 0);
+        if (slab){
+            setorder(p, slab, p->slab_e | SLABBIT);
+            slabinit(p->slabs, p->base, slab, c);
+            mem = slaballoc(p->slabs, p->base, c);
+        }
+    }
+    slabunlock(p, c);
+    return mem;
+}
+
+/*  (1) count an object handed out from class c for a request of size bytes, or a failure if mem is NULL
+    (2) return mem
+*/
+static void *objectcount(Pool *p, int c, size_t size, void *mem){
+    Counters *k = &p->state->classes[c];
+    handout(p, k, size, mem ? slabobjsize(p->slabs, c) : 0);
+    if (mem)
+        count(p, &k->allocated, 1);
+    return mem;
+}
+
+//count a block of 2^e handed out for a request of size bytes, or a failure if mem is NULL, and return mem
+static void *blockcount(Pool *p, int e, size_t size, void *mem){
+    handout(p, counters(p, e), size, mem ? e2size(e) : 0);
+    return mem;
+}
+
+/*  (1) find the CPU the caller runs on w/sched_getcpu, which glibc answers from rseq or the vDSO, w/o a syscall
+    (2) return index of its shard; a thread may move to another CPU right after, which costs only locality
+*/
+static int myshard(Pool *p){
+    int cpu = sched_getcpu();
+    return cpu < 0 ? 0 : cpu % p->nshards;
+}
+
+//shard whose slice holds mem, or NULL if mem is outside the reservation
+static Balloc shardof(Pool *p, void *mem){
+    if (mem < p->base || mem >= p->base + p->size)
+        return NULL;
+    return p->shards[(size_t)(mem - p->base) / p->stride];
+}
+
+/*  (1) try the shard of the CPU the caller runs on, then steal from its neighbours in turn, wrapping around
+    (2) zero the block w/bcalloc if asked to, or align it w/balloc_aligned
+    (3) return pointer to block, or NULL if no shard has room
+    a shard that runs out counts the failure in its stats, even when a neighbour then has room
+*/
+static void *shardalloc(Pool *p, size_t size, size_t align, int zero){
+    int first = myshard(p);
+    for (int i = 0; i < p->nshards; i++){
+        Balloc shard = p->shards[(first + i) % p->nshards];
+        void *mem = zero ? bcalloc(shard, 1, size) : balloc_aligned(shard, size, align);
+        if (mem)
+            return mem;
+    }
+    return NULL;
+}
+
+/*  (1) send requests a slab class holds to the slab layer
+    (2) convert size to exponent e, and allocate a block of 2^e
+    (3) return pointer to memory, or NULL on failure
+*/
+extern void *balloc(Balloc pool, size_t size){
     Pool *p = pool;
 
-    if (size == 0 || size > p->size)
+    if (p->shards)
+        return shardalloc(p, size, 1, 0);
+
+    if (p->slabs){
+        int c = slabclass(p->slabs, size);
+        if (c >= 0)
+            return objectcount(p, c, size, objectalloc(p, c));
+    }
+
+    //convert size to exponent, clamped to valid range
+    int e = sizeorder(p, size);
+    if (e < 0)
+        return blockcount(p, e, size, NULL);    //if request too large, fail
+
+    return blockcount(p, e, size, blockalloc(p, e, 0));
+}
+
+/*  (1) check n * size for overflow
+    (2) a slab object shares its pages w/others, so clear it w/memset
+    (3) a block is cleared only on pages an owner may have written since they were last zero
+    (4) return pointer to zeroed memory, or NULL on failure
+*/
+extern void *bcalloc(Balloc pool, size_t n, size_t size){
+    Pool *p = pool;
+
+    if (size && n > (size_t)-1 / size)
         return NULL;
-    
-    //convert size to exponent
-    int e = size2e(size);
+    size *= n;
 
-    //clamp to valid range
-    if (e < p->l)
-        e = p->l;
-    if (e > p->u)
-        return NULL;    //if request too large, fail
-    
-    //find a free block, startng at level e2size
-    int k;
-    void *block = NULL;
-    for (k = e; k <= p->u; k++){
-        block = freelistalloc(p->freelists, p->base, k, p->l);
-        if (block !=NULL)
-            break;
+    if (p->shards)
+        return shardalloc(p, size, 1, 1);
+    if (p->slabs){
+        int c = slabclass(p->slabs, size);
+        if (c >= 0){
+            void *mem = objectcount(p, c, size, objectalloc(p, c));
+            if (mem)
+                memset(mem, 0, size);
+            return mem;
+        }
     }
 
-    if (block == NULL)
-        return NULL;  //no free block found  
+    int e = sizeorder(p, size);
+    if (e < 0)
+        return blockcount(p, e, size, NULL);
+    return blockcount(p, e, size, blockalloc(p, e, size));
+}
+
+/*  (1) reject an alignment that isn't a power of two
+    (2) a slab object is only 8-byte aligned, so send size to the slab layer only if that's enough
+    (3) otherwise allocate a block of 2^max(e, log2(align)): every block is aligned to its own size,
+        since the pool's base is aligned to 2^u
+    (4) return pointer to memory, or NULL on failure
+*/
+extern void *balloc_aligned(Balloc pool, size_t size, size_t align){
+    Pool *p = pool;
 
-    //split blocks down to desired level
-    while (k > e){
-        k--;
-        split_block(p, block, k + 1);
+    if (align == 0 || (align & (align - 1)))
+        return NULL;
+    if (p->shards)
+        return shardalloc(p, size, align, 0);
+    if (p->slabs && align <= 8){
+        int c = slabclass(p->slabs, size);
+        if (c >= 0)
+            return objectcount(p, c, size, objectalloc(p, c));
     }
 
-    //mark block as allocated in bitmap
-    int index = e - p->l;
+    int e = sizeorder(p, size < align ? align : size);
+    if (e < 0)
+        return blockcount(p, e, size, NULL);
+    return blockcount(p, e, size, blockalloc(p, e, 0));
+}
 
-    //update buddy bitmap to indicate this block is now allocated
-    if(bbmtst(p->buddy_bitmaps[index], p->base, block, e)){
-        //bit was 1, set it to 0
-        bbmclr(p->buddy_bitmaps[index], p->base, block, e);
-    } else {
-        //bit was 0, set it to 1
-        bbmset(p->buddy_bitmaps[index], p->base, block, e);
+/*  (1) cut block of 2^k into 2^(k-e) pieces of 2^e, and hand out the lowest ones, up to want
+    (2) give the rest back to the free lists as the fewest aligned blocks that cover it:
+        the next block starts at piece i and is lowbit(i) pieces long
+    (3) return number of pieces handed out
+    a block of 2^j is split in the cut only if a piece handed out lies in it, so the cut makes
+    taken / 2^(j-e), rounded up, splits at each order j above e
+*/
+static size_t cut(Pool *p, void *block, int k, int e, size_t want, void **out){
+    size_t pieces = (size_t)1 << (k - e);
+    size_t taken = want < pieces ? want : pieces;
+
+    tally(p, e, taken);
+    for (int j = e + 1; j <= k; j++)
+        count(p, &p->state->counters[j - p->l].splits, divup(taken, (size_t)1 << (j - e)));
+
+    for (size_t i = 0; i < taken; i++){
+        out[i] = block + (i << e);
+        setorder(p, out[i], e);
     }
+    markdirty(p, block, taken << e);
 
-    //mark this specific block as allocated in alloc bitmap
-    bbmset(p->alloc_bitmaps[index], p->base, block, e);
+    for (size_t i = taken; i < pieces; ){
+        size_t run = i & -i;
+        push(p, block + (i << e), e + size2e(run));
+        i += run;
+    }
+    return taken;
+}
 
-    return block;
-    
+/*  (1) convert size to exponent e, and lock level e for the whole batch
+    (2) pop whatever level e's free list has
+    (3) for the rest, take one larger block and cut it into as many 2^e pieces as are still wanted,
+        instead of splitting one block per request
+    (4) repeat until n blocks are handed out or the pool runs out, even once deferred blocks are coalesced
+    (5) return number of blocks stored in out, which is less than n only if the pool ran out
+*/
+extern size_t balloc_bulk(Balloc pool, size_t size, size_t n, void **out){
+    Pool *p = pool;
+
+    //the caller's shard first, then its neighbours, like balloc
+    if (p->shards){
+        size_t got = 0;
+        for (int i = 0, first = myshard(p); i < p->nshards && got < n; i++)
+            got += balloc_bulk(p->shards[(first + i) % p->nshards], size, n - got, out + got);
+        return got;
+    }
+
+    //slab objects come one at a time
+    if (p->slabs && slabclass(p->slabs, size) >= 0){
+        size_t got = 0;
+        while (got < n && (out[got] = balloc(p, size)) != NULL)
+            got++;
+        return got;
+    }
+
+    int e = sizeorder(p, size);
+    if (e < 0){
+        handout(p, counters(p, e), size, 0);
+        return 0;
+    }
+
+    size_t got = 0;
+    lock(p, e);
+    begin(p, e);
+    while (got < n){
+        void *block;
+        while (got < n && (block = pop(p, e)) != NULL){
+            tally(p, e, 1);
+            setorder(p, block, e);
+            markdirty(p, block, e2size(e));
+            out[got++] = block;
+        }
+        if (got == n)
+            break;
+
+        int k, held;
+        block = take(p, e, &k, &held);
+        if (block)
+            got += cut(p, block, k, e, n - got, out + got);
+        for (int j = e + 1; j <= held; j++)
+            unlock(p, j);
+        if (block == NULL && p->deferred){
+            //coalescing takes level e's lock too, so let it go while deferred blocks are flushed
+            unlock(p, e);
+            size_t flushed = flush(p);
+            lock(p, e);
+            if (flushed)
+                continue;
+        }
+        if (block == NULL){
+            count(p, &p->state->counters[e - p->l].fails, 1);
+            break;
+        }
+    }
+    end(p, e);
+    unlock(p, e);
+
+    Counters *c = counters(p, e);
+    count(p, &c->requested, got * size);
+    count(p, &c->granted, got << e);
+    charge(p, c, got << e);
+    if (got < n)
+        count(p, &c->failed, 1);
+    return got;
+}
+
+/*  (1) w/lock-free lists, free block of 2^e at mem, or claim its free buddy, in one atomic step
+    (2) while the buddy was claimed, merge into the larger block, and free that one level up
+    (3) if purging, purge each block before it is freed, since another thread may take it the moment it is
+    (4) a claimed buddy is out of the lists until the merged block is freed, so all of it is one step, begun at e
+    (5) return number of bytes released
+*/
+static size_t lfcoalesce(Pool *p, void *mem, int e, int purging){
+    size_t released = 0;
+    int from = e;
+    begin(p, from);
+    for (;;){
+        if (purging && e >= p->state->purge_e)
+            released += purge(p, mem, e);
+        if (!lflistfree(p->lflists, p->base, mem, e)){
+            end(p, from);
+            return released;
+        }
+        count(p, &p->state->counters[e - p->l].merges, 1);
+        mem = p->base + ((size_t)(mem - p->base) & ~(e2size(e + 1) - 1));
+        e++;
+    }
 }
 
-/*  (1) determine block's size by checking bmap
-    (2) mark as free
-    (3) attempt to coalesce w/buddy:
+/*  (1) mark allocated block of 2^e at mem as free
+        w/deferred lists, leave it there at its own size, and stop, unless its level is at the watermark
+    (2) attempt to coalesce w/buddy:
         while buddy is also free:
-            remove buddy from free list
-            clear buddy bit in bitmap
+            unlink buddy from free list in constant time
             merge into larger block
             move up to next level and repeat
-    (4) add final block to appropriate free list
+    (3) add final block to appropriate free list
+        w/a tree, (2) and (3) are one walk up the tree from the block's node
+        w/lock-free lists, one atomic step at each level, and no locks
+    (4) purge it, or trim the pool, if the purge policy says to
+    locking: hand over hand up the levels, level e+1 is locked before level e is released
+*/
+static void blockfree(Pool *p, void *mem, int e){
+    //erase order, block is no longer allocated
+    setorder(p, mem, 0);
+    tally(p, e, -1);
+
+    if (p->lflists){
+        lfcoalesce(p, mem, e, p->state->decay_ms == 0);
+        if (p->state->decay_ms > 0)
+            decay(p);
+        return;
+    }
+
+    if (!defer(p, mem, e))
+        coalesce(p, mem, e);
+
+    if (p->state->decay_ms > 0)
+        decay(p);
+}
+
+/*  (1) determine block's size with one order map lookup
+        an object in a slab is freed in its slab instead, and the slab freed once empty
+    (2) free the block, coalescing it w/its buddies
+    (3) return nothing
 */
 extern void  bfree(Balloc pool, void *mem){
     Pool *p = pool;
@@ -224,97 +1537,488 @@ extern void  bfree(Balloc pool, void *mem){
     if (mem == NULL || mem < p->base || mem >= p->base + p->size)
         return; //invalid pointer, ignore
 
-    //determine block size by checking alloc bitmap
-    int e = -1;
-    for(int level = p->l; level <= p->u; level++){
-        int index = level - p->l;
-        if (bbmtst(p->alloc_bitmaps[index], p->base, mem, level)){
-            e = level;
-            break;
+    //a block goes back to the shard whose slice it is in, whichever CPU frees it
+    if (p->shards){
+        bfree(shardof(p, mem), mem);
+        return;
+    }
+
+    //objects in a slab go back to it, and an emptied slab goes back to the pool
+    void *slab = slabof(p, mem);
+    if (slab){
+        int c = slabclassof(slab);
+        slablock(p, c);
+        int rc = slabfree(p->slabs, p->base, slab, mem);
+        if (rc == 1)
+            setorder(p, slab, p->slab_e);
+        slabunlock(p, c);
+
+        if (rc < 0){
+            fprintf(stderr, "Error: Attempt to free unallocated block at %p\n", mem);
+            return;
         }
+        giveback(p, &p->state->classes[c], slabobjsize(p->slabs, c));
+        count(p, &p->state->classes[c].allocated, -1);
+        if (rc == 1)
+            blockfree(p, slab, p->slab_e);
+        return;
     }
 
-    if (e == -1)
+    //determine block size from order map
+    int e = blockorder(p, mem);
+
+    if (e == 0){
         fprintf(stderr, "Error: Attempt to free unallocated block at %p\n", mem);
-        return; //block not found in alloc bitmap, ignore
+        return; //no block starts here, ignore
+    }
+    giveback(p, counters(p, e), e2size(e));
+    blockfree(p, mem, e);
+}
 
-    //clear allocation bit
-    int index = e - p->l;
-    bbmclr(p->alloc_bitmaps[index], p->base, mem, e);
+//compare block addresses, for qsort
+static int byaddress(const void *a, const void *b){
+    void *x = *(void * const *)a;
+    void *y = *(void * const *)b;
+    return x < y ? -1 : x > y;
+}
 
-    //try to coalesce with buddy
-    while (e < p->u){
-        index = e - p->l;
+/*  (1) sort mem by address, in place, so buddies sit next to each other
+    (2) one pass w/a stack: push each block, and while the top two are allocated buddies of the same size,
+        merge them into one allocated block of the next size using only the order map, and its live bytes w/it
+    (3) bfree what is left on the stack, coalescing w/free buddies as usual
+    (4) return nothing, mem's contents are left in unspecified order
+    a tree pool skips the merge, its tree has to see each block freed at the size it was handed out
+*/
+extern void bfree_bulk(Balloc pool, void **mem, size_t n){
+    Pool *p = pool;
 
-        if (bbmtst(p->buddy_bitmaps[index], p->base, mem, e)){
-            //buddy is allocated, can't coalesce
-            bbmclr(p->buddy_bitmaps[index], p->base, mem, e);
-            break;
-        } else {
-            //buddy is free, coalesce
-            void *buddy = baddrinv(p->base, mem, e);
-            
-            //remove buddy from free list
-            void **lists = p->freelists;
-            void **head = &lists[index];
-            void **current = head;
-
-            int found = 0;
-            while (*current != NULL){
-                if (*current == buddy){
-                    //found buddy, remove from list
-                    *current = *(void **)(*current);
-                    found = 1;
-                    break;
-                }
-                current = (void **)(*current);
-            }
+    qsort(mem, n, sizeof(void *), byaddress);
 
-            if (!found){
-                fprintf(stderr, "Error: Buddy block at %p not found in free list during coalescing\n", buddy);
-                bbmset(p->buddy_bitmaps[index], p->base, mem, e); //restore buddy bit since we couldn't coalesce    
+    //blocks sorted by address come in one run per shard
+    if (p->shards){
+        for (size_t i = 0, j; i < n; i = j){
+            Balloc shard = shardof(p, mem[i]);
+            for (j = i + 1; j < n && shardof(p, mem[j]) == shard; j++)
+                ;
+            if (shard)
+                bfree_bulk(shard, mem + i, j - i);
+        }
+        return;
+    }
+
+    size_t top = 0;
+    for (size_t i = 0; i < n; i++){
+        if (mem[i] == NULL || mem[i] < p->base || mem[i] >= p->base + p->size)
+            continue;
+        mem[top++] = mem[i];
+
+        while (top >= 2 && !p->tree){
+            void *lo = mem[top - 2], *hi = mem[top - 1];
+            int e = blockorder(p, lo);
+            if (e == 0 || e >= p->u || blockorder(p, hi) != e || baddrtst(p->base, lo, e) || hi != lo + e2size(e))
                 break;
-            }
+            setorder(p, hi, 0);
+            setorder(p, lo, e + 1);
+            count(p, &p->state->counters[e - p->l].allocated, -2);
+            count(p, &p->state->counters[e + 1 - p->l].allocated, 1);
+            count(p, &p->state->counters[e - p->l].merges, 1);
+            //its bytes were handed out at e, and bfree gives them back at e + 1, so move them up w/it
+            count(p, &counters(p, e)->live, -(long)e2size(e + 1));
+            count(p, &counters(p, e + 1)->live, e2size(e + 1));
+            top--;
+        }
+    }
 
-            if (buddy < mem){
-                mem = buddy; //lower address becomes new block
-            }
+    for (size_t i = 0; i < top; i++)
+        bfree(p, mem[i]);
+}
 
-            //more to next
-            e++;
+/*  (1) shrink: give back the upper half of the block at each order from e-1 down to ne
+        the halves can't coalesce, since their buddies are what's left of the block
+    (2) grow: only if mem is the lower buddy at every order from e to ne-1, and each upper buddy
+        is free, which is exactly when its buddy bit is set, since the lower one is allocated
+        unlink every upper buddy, and the block spans them
+    (3) w/a tree, the tree does both
+        w/lock-free lists, claim the upper buddies one at a time, and free the ones claimed if one isn't free
+    (4) return 1 if the block at mem is now 2^ne, 0 if it can't grow in place
+    locking: every level between e and ne is held, in ascending order, or w/a tree the tree's one lock
+*/
+static int resize(Pool *p, void *mem, int e, int ne){
+    int lo = e < ne ? e : ne, hi = e < ne ? ne : e;
+    int ok = 1;
+
+    if (p->tree){
+        lock(p, lo);
+        ok = treeresize(p->tree, mem - p->base, e, ne) == 0;
+        unlock(p, lo);
+    } else if (p->lflists){
+        begin(p, e);
+        if (ne < e){
+            for (int k = e - 1; k >= ne; k--)
+                push(p, mem + e2size(k), k);
+        } else {
+            int k = e;
+            ok = ((size_t)(mem - p->base) & (e2size(ne) - 1)) == 0;
+            for (; ok && k < ne; k++)
+                ok = lflistclaim(p->lflists, p->base, mem + e2size(k), k);
+            for (k -= 2; !ok && k >= e; k--)
+                push(p, mem + e2size(k), k);
         }
+        end(p, e);
+    } else {
+        for (int k = lo; k < hi; k++)
+            lock(p, k);
+        if (ne < e){
+            for (int k = e - 1; k >= ne; k--)
+                push(p, mem + e2size(k), k);
+        } else {
+            ok = ((size_t)(mem - p->base) & (e2size(ne) - 1)) == 0;
+            for (int k = e; ok && k < ne; k++)
+                ok = bbmtst(p->buddy_bitmaps[k - p->l], p->base, mem, k);
+            for (int k = e; ok && k < ne; k++)
+                unlink_block(p, mem + e2size(k), k);
+        }
+        for (int k = hi - 1; k >= lo; k--)
+            unlock(p, k);
     }
 
-    //add block to free list for final level
-    freelistfree(p->freelists, p->base, mem, e, p->l);
+    if (ok){
+        tally(p, e, -1);
+        tally(p, ne, 1);
+        //shrinking splits one block at each order from e down to ne+1, growing merges one pair at each from e to ne-1
+        for (int k = lo; k < hi; k++){
+            if (ne < e)
+                count(p, &p->state->counters[k + 1 - p->l].splits, 1);
+            else
+                count(p, &p->state->counters[k - p->l].merges, 1);
+        }
+        setorder(p, mem, ne);
+        if (ne > e)
+            markdirty(p, mem + e2size(e), e2size(ne) - e2size(e));
+    }
+    return ok;
 }
 
-/*  (1) start @ 1, check each bmap
-    (2) find the level where this block is allocated, and return size of block (2^e)
+/*  (1) NULL mem is balloc, size 0 is bfree
+    (2) if the block already has the right size, or a slab object still holds size, keep it
+    (3) shrink a block in place, or grow it in place into free upper buddies
+    (4) otherwise allocate a new block, copy what fits, and free the old one
+    (5) return pointer to memory, or NULL w/mem untouched if the pool has no room
+*/
+extern void *brealloc(Balloc pool, void *mem, size_t size){
+    Pool *p = pool;
+
+    if (mem == NULL)
+        return balloc(p, size);
+    if (size == 0){
+        bfree(p, mem);
+        return NULL;
+    }
+
+    //resize in the owning shard, or failing that, move to any shard w/room
+    if (p->shards){
+        Balloc shard = shardof(p, mem);
+        if (shard == NULL)
+            return NULL;
+        void *new = brealloc(shard, mem, size);
+        size_t old = new ? 0 : bsize(shard, mem);
+        if (old == 0 || (new = shardalloc(p, size, 1, 0)) == NULL)
+            return new;
+        memcpy(new, mem, old < size ? old : size);
+        bfree(shard, mem);
+        return new;
+    }
+
+    size_t old = bsize(p, mem);
+    if (old == 0)
+        return NULL;    //not an allocated block
+
+    if (slabof(p, mem)){
+        if (size <= old){
+            Counters *k = &p->state->classes[slabclassof(slabof(p, mem))];
+            giveback(p, k, old);
+            handout(p, k, size, old);
+            return mem;
+        }
+    } else {
+        int e = blockorder(p, mem);
+        int ne = sizeorder(p, size);
+        if (ne == e || (ne >= 0 && resize(p, mem, e, ne))){
+            giveback(p, counters(p, e), old);
+            handout(p, counters(p, ne), size, e2size(ne));
+            return mem;
+        }
+    }
+
+    void *new = balloc(p, size);
+    if (new == NULL)
+        return NULL;
+    memcpy(new, mem, old < size ? old : size);
+    bfree(p, mem);
+    return new;
+}
+
+/*  (1) look up block's exponent in order map, or object's size if mem is in a slab
+    (2) return size of block (2^e)
     (3) return 0 if block is not allocated
 */
-extern unsigned int bsize(Balloc pool, void *mem){
+extern size_t bsize(Balloc pool, void *mem){
     Pool *p = pool;
 
     if (mem == NULL || mem < p->base || mem >= p->base + p->size)
         return 0; //invalid pointer, return 0
+
+    if (p->shards)
+        return bsize(shardof(p, mem), mem);
+    void *slab = slabof(p, mem);
+    if (slab)
+        return slabsize(p->slabs, slab, mem);
     
-    //check each level's alloc bitmap to find block size
+    int e = blockorder(p, mem);
+    return e ? e2size(e) : 0;
+}
+
+/*  (1) set purge policy: free blocks of 2^e bytes or more get their pages released to the OS
+        e is raised to two pages if smaller, since a free block's first page keeps its links,
+        or to one page for a tree or lock-free pool
+    (2) decay_ms 0 purges a block as soon as bfree coalesces it, decay_ms > 0 has bfree run btrim
+        at most once every decay_ms, and decay_ms < 0 leaves purging to explicit btrim calls
+    (3) w/BALLOC_PERCPU, set it for every shard
+    (4) return nothing
+*/
+extern void bsetpurge(Balloc pool, int e, int decay_ms){
+    Pool *p = pool;
+    for (int i = 0; i < p->nshards; i++){
+        bsetpurge(p->shards[i], e, decay_ms);
+    }
+    int least = p->pageshift + (p->freelists ? 1 : 0);
+    p->state->purge_e = e > least ? e : least;
+    p->state->decay_ms = decay_ms;
+}
+
+/*  (1) set level e's watermark: the most freed 2^e blocks it holds back from coalescing, 0 to coalesce each at once
+    (2) if the level already holds more, coalesce them all
+    (3) w/BALLOC_PERCPU, set it for every shard; a pool w/o BALLOC_DEFER always coalesces at once
+    (4) return nothing
+*/
+extern void bsetdefer(Balloc pool, int e, size_t blocks){
+    Pool *p = pool;
+    for (int i = 0; i < p->nshards; i++){
+        bsetdefer(p->shards[i], e, blocks);
+    }
+    if (!p->deferred || e < p->l || e > p->u)
+        return;
+
+    lock(p, e);
+    p->state->counters[e - p->l].watermark = blocks;
+    int over = p->state->counters[e - p->l].local > blocks;
+    unlock(p, e);
+    if (over)
+        flushlevel(p, e);
+}
+
+// Trim structure: what btrim passes to treewalk for each free block
+typedef struct {
+    Pool *pool;
+    size_t released;
+} Trim;
+
+static void trimblock(size_t offset, int e, void *arg){
+    Trim *trim = arg;
+    trim->released += purge(trim->pool, trim->pool->base + offset, e);
+}
+
+/*  (1) for each level from purge order to u, lock level and walk its free list, and its deferred list
+        w/a tree, lock it and walk every free block of the purge order or more
+        w/lock-free lists, walk each level's free bits, and claim each block before purging it,
+        then free it again, which may merge it w/a buddy freed meanwhile
+        w/BALLOC_PERCPU, trim each shard
+    (2) release dirty pages of every free block on it
+    (3) return number of bytes released
+*/
+extern size_t btrim(Balloc pool){
+    Pool *p = pool;
+    size_t released = 0;
+
+    for (int i = 0; i < p->nshards; i++){
+        released += btrim(p->shards[i]);
+    }
+
+    if (p->tree){
+        Trim trim = {p, 0};
+        lock(p, p->l);
+        treewalk(p->tree, p->state->purge_e > p->l ? p->state->purge_e : p->l, trimblock, &trim);
+        unlock(p, p->l);
+        return trim.released;
+    }
+
+    for (int e = p->state->purge_e > p->l ? p->state->purge_e : p->l; e <= p->u && p->lflists; e++){
+        void *mem = lflistfirst(p->lflists, p->base, e);
+        for (; mem != NULL; mem = lflistnext(p->lflists, p->base, mem, e)){
+            begin(p, e);
+            if (lflistclaim(p->lflists, p->base, mem, e))
+                released += lfcoalesce(p, mem, e, 1);
+            end(p, e);
+        }
+    }
+
+    for (int e = p->state->purge_e > p->l ? p->state->purge_e : p->l; e <= p->u && p->freelists; e++){
+        lock(p, e);
+        void *mem = freelistfirst(p->freelists, p->base, e, p->l);
+        for (; mem != NULL; mem = freelistnext(p->freelists, p->base, mem))
+            released += purge(p, mem, e);
+        mem = p->deferred ? freelistfirst(p->deferred, p->base, e, p->l) : NULL;
+        for (; mem != NULL; mem = freelistnext(p->deferred, p->base, mem))
+            released += purge(p, mem, e);
+        unlock(p, e);
+    }
+    return released;
+}
+
+/*  (1) return base address of pool's memory, where its first block starts
+*/
+extern void *bbase(Balloc pool){
+    Pool *p = pool;
+    return p->base;
+}
+
+//count one free block, for bstats' walk of a tree
+static void countfree(size_t offset, int e, void *arg){
+    BallocStats *stats = arg;
+    (void)offset;
+    stats->levels[e].free++;
+}
+
+//add the counts in s to the ones in stats, all but the peak, which a shard reads off its router
+static void addstats(BallocStats *stats, BallocStats *s){
+    stats->requested += s->requested;
+    stats->granted += s->granted;
+    stats->live += s->live;
+    stats->failed += s->failed;
+    stats->objects += s->objects;
+    stats->untouched += s->untouched;
+    stats->dirty += s->dirty;
+    for (int e = s->l; e <= s->u; e++){
+        stats->levels[e].free += s->levels[e].free;
+        stats->levels[e].allocated += s->levels[e].allocated;
+        stats->levels[e].peak += s->levels[e].peak;
+        stats->levels[e].requested += s->levels[e].requested;
+        stats->levels[e].granted += s->levels[e].granted;
+        stats->levels[e].live += s->levels[e].live;
+        stats->levels[e].splits += s->levels[e].splits;
+        stats->levels[e].merges += s->levels[e].merges;
+        stats->levels[e].fails += s->levels[e].fails;
+    }
+}
+
+//add the byte counts on c to the pool's
+static void addbytes(BallocStats *stats, Counters *c){
+    stats->requested += __atomic_load_n(&c->requested, __ATOMIC_RELAXED);
+    stats->granted += __atomic_load_n(&c->granted, __ATOMIC_RELAXED);
+    stats->live += __atomic_load_n(&c->live, __ATOMIC_RELAXED);
+    stats->failed += __atomic_load_n(&c->failed, __ATOMIC_RELAXED);
+}
+
+/*  (1) copy every counter w/a relaxed load, so other threads keep counting while stats are taken
+        pool byte counts are the sums of each level's and each slab class's, and the peak is the pool's own
+    (2) count free blocks at each level by walking its free list under its lock,
+        or w/a tree, walk every free block under the tree's lock, or w/lock-free lists, count their free bits
+        deferred blocks are free too, and counted w/them
+    (3) add bytes above the high-water mark, and bytes on dirty pages
+    (4) return nothing, each counter is exact but they are not taken at one instant
+    w/BALLOC_PERCPU, add up every shard's stats, and a shard counts a failure when it runs out and a neighbour is stolen from
+*/
+extern void bstats(Balloc pool, BallocStats *stats){
+    Pool *p = pool;
+
+    *stats = (BallocStats){0};
+    stats->l = p->l;
+    stats->u = p->u;
+    if (p->shards){
+        for (int i = 0; i < p->nshards; i++){
+            BallocStats s;
+            bstats(p->shards[i], &s);
+            addstats(stats, &s);
+        }
+        stats->peak = __atomic_load_n(&p->total->peak, __ATOMIC_RELAXED);
+        return;
+    }
     for (int e = p->l; e <= p->u; e++){
-        int index = e - p->l;
-        if (bbmtst(p->alloc_bitmaps[index], p->base, mem, e)){
-            return e2size(e); //block found, return size
+        Counters *c = &p->state->counters[e - p->l];
+        BallocLevel *level = &stats->levels[e];
+        level->allocated = __atomic_load_n(&c->allocated, __ATOMIC_RELAXED);
+        level->peak = __atomic_load_n(&c->peak, __ATOMIC_RELAXED);
+        level->splits = __atomic_load_n(&c->splits, __ATOMIC_RELAXED);
+        level->merges = __atomic_load_n(&c->merges, __ATOMIC_RELAXED);
+        level->fails = __atomic_load_n(&c->fails, __ATOMIC_RELAXED);
+        level->requested = __atomic_load_n(&c->requested, __ATOMIC_RELAXED);
+        level->granted = __atomic_load_n(&c->granted, __ATOMIC_RELAXED);
+        level->live = __atomic_load_n(&c->live, __ATOMIC_RELAXED);
+        addbytes(stats, c);
+    }
+    stats->peak = __atomic_load_n(&p->total->peak, __ATOMIC_RELAXED);
+    for (int c = 0; p->slabs && c < SLABCLASSES; c++){
+        addbytes(stats, &p->state->classes[c]);
+        stats->objects += __atomic_load_n(&p->state->classes[c].allocated, __ATOMIC_RELAXED);
+    }
+
+    if (p->tree){
+        lock(p, p->l);
+        treewalk(p->tree, p->l, countfree, stats);
+        unlock(p, p->l);
+    } else if (p->lflists){
+        for (int e = p->l; e <= p->u; e++)
+            stats->levels[e].free = lflistcount(p->lflists, e);
+    } else {
+        for (int e = p->l; e <= p->u; e++){
+            lock(p, e);
+            void *mem = freelistfirst(p->freelists, p->base, e, p->l);
+            for (; mem != NULL; mem = freelistnext(p->freelists, p->base, mem))
+                stats->levels[e].free++;
+            stats->levels[e].free += p->deferred ? p->state->counters[e - p->l].local : 0;
+            unlock(p, e);
         }
     }
-    return 0;
+
+    stats->untouched = p->size - __atomic_load_n(&p->state->hwm, __ATOMIC_RELAXED);
+    stats->dirty = bmcount(p->dirty, 0, divup(p->size, e2size(p->pageshift))) << p->pageshift;
+}
+
+/*  (1) take stats
+    (2) write them to out as one JSON object, pool totals first, then one object per level
+    (3) return nothing
+*/
+extern void bprintjson(Balloc pool, FILE *out){
+    Pool *p = pool;
+    BallocStats s;
+    bstats(p, &s);
+
+    fprintf(out, "{\"size\": %zu, \"l\": %d, \"u\": %d, ", p->size, s.l, s.u);
+    fprintf(out, "\"requested\": %zu, \"granted\": %zu, \"live\": %zu, \"peak\": %zu, \"failed\": %zu, ",
+            s.requested, s.granted, s.live, s.peak, s.failed);
+    fprintf(out, "\"objects\": %zu, \"untouched\": %zu, \"dirty\": %zu, \"levels\": [",
+            s.objects, s.untouched, s.dirty);
+    for (int e = s.l; e <= s.u; e++){
+        BallocLevel *level = &s.levels[e];
+        fprintf(out, "%s{\"e\": %d, \"size\": %zu, \"free\": %zu, \"allocated\": %zu, \"peak\": %zu, ",
+                e > s.l ? ", " : "", e, e2size(e), level->free, level->allocated, level->peak);
+        fprintf(out, "\"requested\": %zu, \"granted\": %zu, \"live\": %zu, ",
+                level->requested, level->granted, level->live);
+        fprintf(out, "\"splits\": %zu, \"merges\": %zu, \"fails\": %zu}",
+                level->splits, level->merges, level->fails);
+    }
+    fprintf(out, "]}\n");
 }
 
 /*  (1) print pool info: base address, total size, min and max block sizes
+        w/BALLOC_PERCPU, then print each shard as a pool of its own
     (2) for each level from l to u:
         print level number and block size (2^e)
         print bitmap for that level
-        print addresses of free blocks in that level's free list
-    (3) return nothing
+        print addresses of free blocks in that level's free list, then any deferred ones
+        w/a tree, print every free block it holds instead, and w/lock-free lists, the blocks their free bits mark
+    (3) print every allocated block found in the order map
+    (4) return nothing
 */
 extern void bprint(Balloc pool){
     Pool *p = pool;
@@ -324,24 +2028,61 @@ extern void bprint(Balloc pool){
     printf("Total size: %lu bytes\n", p->size);
     printf("Min block size: %lu bytes (2^%d)\n", e2size(p->l), p->l);
     printf("Max block size: %lu bytes (2^%d)\n", e2size(p->u), p->u);
+    if (p->shards){
+        printf("Shards: %d, one every %lu bytes\n\n", p->nshards, p->stride);
+        for (int i = 0; i < p->nshards; i++){
+            printf("Shard %d: ", i);
+            bprint(p->shards[i]);
+            printf("\n");
+        }
+        return;
+    }
+    if (p->state->hwm < p->size)
+        printf("Untouched: %lu bytes from %p\n", p->size - p->state->hwm, p->base + p->state->hwm);
     printf("\n");
 
-    printf("Free Lists:\n");
-    freelistprint(p->freelists, p->l, p->u);
-    printf("\n");
+    if (p->tree){
+        printf("Free Tree:\n");
+        treeprint(p->tree);
+        printf("\n");
+    } else if (p->lflists){
+        printf("Free Lists (lock-free):\n");
+        lflistprint(p->lflists, p->base);
+        printf("\n");
+    } else {
+        printf("Free Lists:\n");
+        freelistprint(p->freelists, p->base, p->l, p->u);
+        printf("\n");
 
-    printf("Buddy Bitmaps:\n");
-    for (int e = p->l; e <= p->u; e++){
-        int index = e - p->l;
-        printf("Level %d (block size %lu): ", e, e2size(e));
-        bbmprt(p->buddy_bitmaps[index]);
+        if (p->deferred){
+            printf("Deferred Lists:\n");
+            freelistprint(p->deferred, p->base, p->l, p->u);
+            printf("\n");
+        }
+
+        printf("Buddy Bitmaps:\n");
+        for (int e = p->l; e <= p->u; e++){
+            int index = e - p->l;
+            printf("Level %d (block size %lu): ", e, e2size(e));
+            bbmprt(p->buddy_bitmaps[index]);
+        }
+        printf("\n");
     }
+
+    size_t pages = divup(p->size, e2size(p->pageshift));
+    printf("Dirty Pages (%zu of %zu): ", bmcount(p->dirty, 0, pages), pages);
+    bmprt(p->dirty);
     printf("\n");
 
-    printf("Allocation Bitmaps:\n");
-    for (int e = p->l; e <= p->u; e++){
-        int index = e - p->l;
-        printf("Level %d (block size %lu): ", e, e2size(e));
-        bbmprt(p->alloc_bitmaps[index]);
+    printf("Allocated Blocks:\n");
+    size_t granules = divup(p->size, e2size(p->l));
+    for (size_t g = 0; g < granules; g++){
+        int e = p->orders[g];
+        if (e & SLABBIT){
+            printf("%p (", p->base + (g << p->l));
+            slabprint(p->slabs, p->base + (g << p->l));
+            printf(")\n");
+        } else if (e)
+            printf("%p (block size %lu, 2^%d)\n", p->base + (g << p->l), e2size(e), e);
     }
 }
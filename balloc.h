@@ -1,15 +1,79 @@
 #ifndef BALLOC_H
 #define BALLOC_H
 
+#include <stdio.h>
+
 typedef void *Balloc;
 
-extern Balloc bcreate(unsigned int size, int l, int u);
+// Counters for one block size, from bstats()
+typedef struct {
+    size_t free;            // free blocks
+    size_t allocated;       // blocks handed out and not yet freed, slabs included
+    size_t peak;            // most blocks allocated at once
+    size_t requested;       // bytes asked for by requests this size answered, slab objects aside
+    size_t granted;         // bytes handed out for them
+    size_t live;            // bytes handed out at this size and not yet freed
+    size_t splits;          // blocks split in two
+    size_t merges;          // pairs of buddies coalesced into one block
+    size_t fails;           // allocations that found no block
+} BallocLevel;
+
+// Counters for a whole pool, from bstats()
+typedef struct {
+    int l, u;               // levels[l..u] are filled in
+    size_t requested;       // bytes asked for, over the pool's life
+    size_t granted;         // bytes handed out for them; granted - requested is internal fragmentation
+    size_t live;            // bytes handed out and not yet freed
+    size_t peak;            // most bytes handed out at once
+    size_t failed;          // allocations that returned NULL
+    size_t objects;         // slab objects handed out and not yet freed
+    size_t untouched;       // bytes above the high-water mark, never handed out
+    size_t dirty;           // bytes on pages marked dirty
+    BallocLevel levels[64];
+} BallocStats;
+
+// bcreatef() flags, OR'd together
+#define BALLOC_THREADSAFE 0x1   // balloc, bfree and bsize may be called from many threads
+#define BALLOC_LAZY       0x2   // carve top-level blocks on first use, O(1) bcreate
+#define BALLOC_TREE       0x4   // keep free space in an out-of-band tree, never writing inside free blocks
+#define BALLOC_SLAB       0x8   // serve requests of up to 512 bytes from slabs of finer size classes
+#define BALLOC_SHARED     0x10  // keep pool and metadata in a memory file other processes can battach; implies THREADSAFE
+#define BALLOC_LOCKFREE   0x20  // keep free lists lock-free, so balloc and bfree take no lock; implies THREADSAFE
+                                // a lock-free pool can't also be TREE or SHARED, or be bsaved
+#define BALLOC_PERCPU     0x40  // split the pool into one sub-pool per CPU, each on its own slice; implies THREADSAFE
+                                // a per-CPU pool can't also be SHARED, or be bsaved
+#define BALLOC_DEFER      0x80  // leave freed blocks at their own size, and coalesce them in batches; not w/TREE or LOCKFREE
+
+extern Balloc bcreate(size_t size, int l, int u);
+extern Balloc bcreatef(size_t size, int l, int u, int flags);
+extern Balloc bcreateshards(size_t size, int l, int u, int flags, int shards);
 extern void   bdelete(Balloc pool);
 
-extern void *balloc(Balloc pool, unsigned int size);
+extern Balloc battach(int fd);
+extern int    bfd(Balloc pool);
+
+extern int    bsave(Balloc pool, const char *path);
+extern Balloc bload(const char *path);
+
+extern void *balloc(Balloc pool, size_t size);
+extern void *balloc_aligned(Balloc pool, size_t size, size_t align);
+extern void *bcalloc(Balloc pool, size_t n, size_t size);
 extern void  bfree(Balloc pool, void *mem);
+extern void *brealloc(Balloc pool, void *mem, size_t size);
+
+extern size_t balloc_bulk(Balloc pool, size_t size, size_t n, void **out);
+extern void   bfree_bulk(Balloc pool, void **mem, size_t n);
+
+extern size_t bsize(Balloc pool, void *mem);
 
-extern unsigned int bsize(Balloc pool, void *mem);
+extern void   bsetpurge(Balloc pool, int e, int decay_ms);
+extern void   bsetdefer(Balloc pool, int e, size_t blocks);
+extern size_t btrim(Balloc pool);
+
+extern void *bbase(Balloc pool);
 extern void bprint(Balloc pool);
 
+extern void bstats(Balloc pool, BallocStats *stats);
+extern void bprintjson(Balloc pool, FILE *out);
+
 #endif
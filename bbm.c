@@ -15,12 +15,16 @@ static size_t bitaddr(void *base, void *mem, int e) {
   return addr/blocksize/2;
 }
 
-extern BBM bbmcreate(size_t size, int e) {
-  return bmcreate(mapsize(size,e));
+extern size_t bbmbytes(size_t size, int e) {
+  return bmbytes(mapsize(size,e));
 }
 
-extern void bbmdelete(BBM b) {
-  bmdelete(b);
+extern BBM bbminit(void *mem, size_t size, int e) {
+  return bminit(mem,mapsize(size,e));
+}
+
+extern void bbmcopy(BBM to, BBM from) {
+  bmcopy(to,from);
 }
 
 extern void bbmset(BBM b, void *base, void *mem, int e) {
@@ -31,6 +35,10 @@ extern void bbmclr(BBM b, void *base, void *mem, int e) {
   bmclr(b,bitaddr(base,mem,e));
 }
 
+extern void bbmflip(BBM b, void *base, void *mem, int e) {
+  bmflip(b,bitaddr(base,mem,e));
+}
+
 extern int bbmtst(BBM b, void *base, void *mem, int e) {
   return bmtst(b,bitaddr(base,mem,e));
 }
@@ -38,21 +46,21 @@ extern int bbmtst(BBM b, void *base, void *mem, int e) {
 extern void bbmprt(BBM b) { bmprt(b); }
 
 extern void *baddrset(void *base, void *mem, int e) {
-  unsigned int mask=1<<e;
+  size_t mask=(size_t)1<<e;
   return base+((mem-base)|mask);
 }
 
 extern void *baddrclr(void *base, void *mem, int e) {
-  unsigned int mask=~(1<<e);
+  size_t mask=~((size_t)1<<e);
   return base+((mem-base)&mask);
 }
 
 extern void *baddrinv(void *base, void *mem, int e) {
-  unsigned int mask=1<<e;
+  size_t mask=(size_t)1<<e;
   return base+((mem-base)^mask);
 }
 
 extern int baddrtst(void *base, void *mem, int e) {
-  unsigned int mask=1<<e;
-  return (mem-base)&mask;
+  size_t mask=(size_t)1<<e;
+  return ((mem-base)&mask)!=0;
 }
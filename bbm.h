@@ -7,11 +7,13 @@
 
 typedef void *BBM;
 
-extern BBM  bbmcreate(size_t size, int e);
-extern void bbmdelete(BBM b);
+extern size_t bbmbytes(size_t size, int e);
+extern BBM    bbminit(void *mem, size_t size, int e);
+extern void   bbmcopy(BBM to, BBM from);
 
 extern void bbmset(BBM b, void *base, void *mem, int e);
 extern void bbmclr(BBM b, void *base, void *mem, int e);
+extern void bbmflip(BBM b, void *base, void *mem, int e);
 extern  int bbmtst(BBM b, void *base, void *mem, int e);
 
 extern void bbmprt(BBM b);
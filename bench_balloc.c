@@ -0,0 +1,907 @@
+/* Author: Zella Running
+ * Description: Benchmarks for buddy system allocator. Each benchmark times one hot path of balloc.c and prints a small table.
+ * Class: CS 451 - HW2 Memory Allocator w/Buddy System
+ * Date: 2026 February 11
+ */
+#include "balloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//resident set size of this process in bytes
+static size_t rss() {
+    size_t pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%zu %zu", &pages, &resident) != 2)
+            resident = 0;
+        fclose(f);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+//free latency as the number of free blocks on the minimum level grows
+void bench_free_latency() {
+    printf("=== Bench: Free Latency vs. Free-List Length ===\n");
+    printf("%10s %12s\n", "free blks", "ns/free");
+
+    const int l = 4, u = 22;
+    for (int n = 256; n <= 65536; n *= 2) {
+        Balloc pool = bcreate(1u << u, l, u);
+        void **blocks = malloc(2 * n * sizeof(void *));
+
+        for (int i = 0; i < 2 * n; i++)
+            blocks[i] = balloc(pool, 1 << l);
+
+        //free every even block, leaving n free blocks on level l whose buddies are allocated
+        for (int i = 0; i < 2 * n; i += 2)
+            bfree(pool, blocks[i]);
+
+        //free the odd blocks, each one unlinks its buddy from a list of ~n blocks
+        double start = now();
+        for (int i = 1; i < 2 * n; i += 2)
+            bfree(pool, blocks[i]);
+        double elapsed = now() - start;
+
+        printf("%10d %12.1f\n", n, elapsed / n);
+
+        free(blocks);
+        bdelete(pool);
+    }
+    printf("\n");
+}
+
+//alloc/free churn of small mixed sizes in a fixed 16 MiB pool while u-l grows
+void bench_levels() {
+    printf("=== Bench: Alloc/Free Cost vs. Number of Levels ===\n");
+    printf("%6s %12s\n", "u-l", "ns/op");
+
+    const int l = 4, live = 1024, rounds = 1 << 20;
+    const size_t size = 1 << 24;
+    void **blocks = calloc(live, sizeof(void *));
+
+    for (int u = 10; u <= 24; u += 2) {
+        Balloc pool = bcreate(size, l, u);
+        srand(1);
+
+        double start = now();
+        for (int i = 0; i < rounds; i++) {
+            int slot = rand() % live;
+            if (blocks[slot]) {
+                bfree(pool, blocks[slot]);
+                blocks[slot] = NULL;
+            } else {
+                blocks[slot] = balloc(pool, 16 << (rand() % 6));
+            }
+        }
+        double elapsed = now() - start;
+
+        printf("%6d %12.1f\n", u - l, elapsed / rounds);
+
+        memset(blocks, 0, live * sizeof(void *));
+        bdelete(pool);
+    }
+    free(blocks);
+    printf("\n");
+}
+
+//bcreate time and resident memory for eager and lazy pools as the pool grows
+void bench_create() {
+    printf("=== Bench: Pool Creation, Eager vs. Lazy ===\n");
+    printf("%10s %14s %14s %14s %14s\n", "pool", "eager us", "eager RSS KiB", "lazy us", "lazy RSS KiB");
+
+    for (int s = 24; s <= 34; s += 2) {
+        double us[2];
+        size_t kib[2];
+        for (int lazy = 0; lazy < 2; lazy++) {
+            size_t before = rss();
+            double start = now();
+            Balloc pool = bcreatef((size_t)1 << s, 4, 20, lazy ? BALLOC_LAZY : 0);
+            us[lazy] = (now() - start) / 1e3;
+            kib[lazy] = (rss() - before) / 1024;
+            bdelete(pool);
+        }
+        printf("%8s%d %14.1f %14zu %14.1f %14zu\n", "2^", s, us[0], kib[0], us[1], kib[1]);
+    }
+    printf("\n");
+}
+
+//RSS released by btrim, and what touching the memory again costs afterwards
+void bench_trim() {
+    printf("=== Bench: Trim RSS and Re-fault Cost ===\n");
+
+    const int blocks = 256;
+    const size_t blocksize = 1 << 20;
+    Balloc pool = bcreatef(blocks * blocksize, 12, 20, BALLOC_LAZY);
+    char *p[256];
+
+    //touch every page once, then free it all
+    for (int i = 0; i < blocks; i++) {
+        p[i] = balloc(pool, blocksize);
+        memset(p[i], 1, blocksize);
+    }
+    for (int i = 0; i < blocks; i++)
+        bfree(pool, p[i]);
+
+    //refill without trimming: pages are still resident
+    double start = now();
+    for (int i = 0; i < blocks; i++) {
+        p[i] = balloc(pool, blocksize);
+        memset(p[i], 2, blocksize);
+    }
+    double resident = now() - start;
+    for (int i = 0; i < blocks; i++)
+        bfree(pool, p[i]);
+
+    size_t before = rss();
+    start = now();
+    size_t released = btrim(pool);
+    double trim = now() - start;
+    size_t after = rss();
+
+    //refill after trimming: every page faults back in
+    start = now();
+    for (int i = 0; i < blocks; i++) {
+        p[i] = balloc(pool, blocksize);
+        memset(p[i], 3, blocksize);
+    }
+    double refault = now() - start;
+    for (int i = 0; i < blocks; i++)
+        bfree(pool, p[i]);
+
+    printf("btrim released   %10zu KiB in %.2f ms\n", released / 1024, trim / 1e6);
+    printf("RSS              %10zu KiB -> %zu KiB\n", before / 1024, after / 1024);
+    printf("refill resident  %10.2f ms (%.0f ns/page)\n", resident / 1e6, resident / (blocks * blocksize / 4096));
+    printf("refill refault   %10.2f ms (%.0f ns/page)\n", refault / 1e6, refault / (blocks * blocksize / 4096));
+
+    bdelete(pool);
+    printf("\n");
+}
+
+//per-block cost of filling and emptying a pool one call at a time vs. in batches
+void bench_bulk() {
+    printf("=== Bench: Scalar vs. Bulk Alloc/Free ===\n");
+    printf("%8s %14s %14s %14s %14s\n", "batch", "scalar alloc", "bulk alloc", "scalar free", "bulk free");
+
+    const int rounds = 256;
+    const size_t size = 64, total = 1 << 14;
+    static void *blocks[1 << 14];
+    Balloc pool = bcreate(total * size, 4, 20);
+
+    for (size_t n = 8; n <= total; n *= 8) {
+        double t[4] = {0, 0, 0, 0};
+        for (int r = 0; r < rounds; r++) {
+            double start = now();
+            for (size_t i = 0; i < n; i++)
+                blocks[i] = balloc(pool, size);
+            t[0] += now() - start;
+
+            start = now();
+            for (size_t i = 0; i < n; i++)
+                bfree(pool, blocks[i]);
+            t[2] += now() - start;
+
+            start = now();
+            balloc_bulk(pool, size, n, blocks);
+            t[1] += now() - start;
+
+            start = now();
+            bfree_bulk(pool, blocks, n);
+            t[3] += now() - start;
+        }
+        printf("%8zu", n);
+        for (int i = 0; i < 4; i++)
+            printf(" %11.1f ns", t[i] / ((double)rounds * n));
+        printf("\n");
+    }
+    bdelete(pool);
+    printf("\n");
+}
+
+//minor page faults taken by this process so far
+static long faults() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_minflt;
+}
+
+//open a hardware cache-miss counter for this thread, -1 if perf events aren't available
+static int missesopen() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long missesread(int fd) {
+    long long count = 0;
+    if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count))
+        return -1;
+    return count;
+}
+
+//objects that fit in a 1 MiB pool, and alloc+free cost, for small odd sizes w/and w/o slabs
+void bench_slab() {
+    printf("=== Bench: Slab Size Classes ===\n");
+    printf("%6s %10s %10s %10s %10s %10s %10s\n", "size", "buddy fit", "used %", "ns/op", "slab fit", "used %", "ns/op");
+
+    const size_t poolsize = 1 << 20;
+    const size_t sizes[] = {8, 24, 48, 96, 200, 384};
+    static void *objs[1 << 17];
+
+    for (int s = 0; s < 6; s++) {
+        printf("%6zu", sizes[s]);
+        for (int slab = 0; slab < 2; slab++) {
+            Balloc pool = bcreatef(poolsize, 4, 20, slab ? BALLOC_SLAB : 0);
+
+            size_t n = 0;
+            double start = now();
+            while (n < (1 << 17) && (objs[n] = balloc(pool, sizes[s])) != NULL)
+                n++;
+            for (size_t i = 0; i < n; i++)
+                bfree(pool, objs[i]);
+            double elapsed = now() - start;
+
+            printf(" %10zu %10.1f %10.1f", n, 100.0 * n * sizes[s] / poolsize, elapsed / n);
+            bdelete(pool);
+        }
+        printf("\n");
+    }
+    printf("\n");
+}
+
+//cost and RSS of a 64 MiB zeroed table: bcalloc vs. balloc + memset, fresh, reused dirty, and after btrim
+void bench_calloc() {
+    printf("=== Bench: Zero-Aware Calloc ===\n");
+    printf("%10s %14s %14s %14s %14s\n", "memory", "memset ms", "memset RSS KiB", "bcalloc ms", "bcalloc RSS KiB");
+
+    const size_t size = (size_t)64 << 20;
+    const char *states[3] = {"fresh", "dirty", "trimmed"};
+    double ms[2][3];
+    size_t kib[2][3];
+
+    for (int z = 0; z < 2; z++) {
+        Balloc pool = bcreatef(size * 2, 12, 27, BALLOC_LAZY);
+        for (int s = 0; s < 3; s++) {
+            size_t before = rss();
+            double start = now();
+            char *p = z ? bcalloc(pool, 1, size) : balloc(pool, size);
+            if (!z)
+                memset(p, 0, size);
+            ms[z][s] = (now() - start) / 1e6;
+            kib[z][s] = rss() > before ? (rss() - before) / 1024 : 0;
+
+            //the owner fills its table before giving it back
+            memset(p, 1, size);
+            bfree(pool, p);
+            if (s == 1)
+                btrim(pool);
+        }
+        bdelete(pool);
+    }
+    for (int s = 0; s < 3; s++)
+        printf("%10s %14.2f %14zu %14.2f %14zu\n", states[s], ms[0][s], kib[0][s], ms[1][s], kib[1][s]);
+    printf("\n");
+}
+
+#define ENGINE_ROUNDS (1 << 21)
+#define ENGINE_LIVE   (1 << 16)
+
+//free-list vs. tree engine: churn mixed small blocks across a fresh 1 GiB pool without touching them,
+//so every page fault and most cache misses come from the allocator's own metadata
+void bench_engines() {
+    printf("=== Bench: Free-List vs. Tree Engine ===\n");
+    printf("%10s %10s %14s %14s\n", "engine", "ns/op", "page faults", "cache misses");
+
+    static void *live[ENGINE_LIVE];
+    const char *names[2] = {"free list", "tree"};
+    int flags[2] = {BALLOC_LAZY, BALLOC_TREE};
+    int fd = missesopen();
+
+    for (int i = 0; i < 2; i++) {
+        Balloc pool = bcreatef((size_t)1 << 30, 4, 20, flags[i]);
+        memset(live, 0, sizeof(live));
+        srand(1);
+
+        long f = faults();
+        long long m = missesread(fd);
+        double start = now();
+        for (int r = 0; r < ENGINE_ROUNDS; r++) {
+            int slot = rand() % ENGINE_LIVE;
+            if (live[slot]) {
+                bfree(pool, live[slot]);
+                live[slot] = NULL;
+            } else {
+                live[slot] = balloc(pool, 16 << (rand() % 9));
+            }
+        }
+        double elapsed = now() - start;
+        long long misses = missesread(fd);
+        f = faults() - f;
+
+        if (m < 0 || misses < 0)
+            printf("%10s %10.1f %14ld %14s\n", names[i], elapsed / ENGINE_ROUNDS, f, "n/a");
+        else
+            printf("%10s %10.1f %14ld %14lld\n", names[i], elapsed / ENGINE_ROUNDS, f, misses - m);
+
+        for (int slot = 0; slot < ENGINE_LIVE; slot++)
+            bfree(pool, live[slot]);
+        bdelete(pool);
+    }
+    if (fd >= 0)
+        close(fd);
+    printf("\n");
+}
+
+#define SCALE_ROUNDS (1 << 20)
+
+static Balloc scale_pool;
+static int scale_same;      //1: every thread churns 64-byte blocks, all contending on one level
+
+//churn blocks of one size class per thread, so threads mostly lock different levels
+static void *scale_thread(void *arg) {
+    int id = (int)(long)arg;
+    unsigned int size = scale_same ? 64 : 16 << (id % 6);
+    void *live[64] = {0};
+
+    for (int i = 0; i < SCALE_ROUNDS; i++) {
+        int slot = i * 7 % 64;
+        if (live[slot]) {
+            bfree(scale_pool, live[slot]);
+            live[slot] = NULL;
+        } else {
+            live[slot] = balloc(scale_pool, size);
+        }
+    }
+    for (int slot = 0; slot < 64; slot++)
+        bfree(scale_pool, live[slot]);
+    return NULL;
+}
+
+//time n threads of scale_thread on a fresh pool w/flags, in Mops/s
+static double scale_run(int flags, int n, pthread_t *threads) {
+    scale_pool = bcreatef(1u << 24, 4, 24, flags);
+
+    double start = now();
+    for (long i = 0; i < n; i++)
+        pthread_create(&threads[i], NULL, scale_thread, (void *)i);
+    for (int i = 0; i < n; i++)
+        pthread_join(threads[i], NULL);
+    double elapsed = now() - start;
+
+    bdelete(scale_pool);
+    return (double)n * SCALE_ROUNDS / elapsed * 1e3;
+}
+
+//throughput of a thread-safe pool from 1 thread up to twice the number of CPUs
+void bench_thread_scaling() {
+    printf("=== Bench: Thread-Safe Pool Scaling ===\n");
+    printf("(%ld CPUs online)\n", sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%8s %12s\n", "threads", "Mops/s");
+
+    int max = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    if (max < 8)
+        max = 8;
+    pthread_t *threads = malloc(max * sizeof(pthread_t));
+
+    for (int n = 1; n <= max; n *= 2)
+        printf("%8d %12.2f\n", n, scale_run(BALLOC_THREADSAFE, n, threads));
+    free(threads);
+    printf("\n");
+}
+
+//lock-free lists against per-level mutexes, w/threads on their own levels, then all on one
+void bench_lockfree() {
+    printf("=== Bench: Lock-Free vs. Mutex Free Lists ===\n");
+    printf("(%ld CPUs online)\n", sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%8s %14s %14s %14s %14s\n", "threads", "mutex mixed", "lockfree mixed", "mutex same", "lockfree same");
+
+    int max = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    if (max < 8)
+        max = 8;
+    pthread_t *threads = malloc(max * sizeof(pthread_t));
+
+    for (int n = 1; n <= max; n *= 2) {
+        printf("%8d", n);
+        for (scale_same = 0; scale_same <= 1; scale_same++) {
+            printf(" %14.2f", scale_run(BALLOC_THREADSAFE, n, threads));
+            printf(" %14.2f", scale_run(BALLOC_LOCKFREE, n, threads));
+        }
+        printf("\n");
+    }
+    scale_same = 0;
+    free(threads);
+    printf("\n");
+}
+
+//one pool shared by every CPU against one shard per CPU, locked and lock-free
+void bench_percpu() {
+    printf("=== Bench: Per-CPU Shards ===\n");
+    printf("(%ld CPUs online)\n", sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%8s %14s %14s %14s\n", "threads", "one pool", "shards", "lockfree shards");
+
+    int max = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    if (max < 8)
+        max = 8;
+    pthread_t *threads = malloc(max * sizeof(pthread_t));
+
+    for (int n = 1; n <= max; n *= 2) {
+        printf("%8d", n);
+        printf(" %14.2f", scale_run(BALLOC_THREADSAFE, n, threads));
+        printf(" %14.2f", scale_run(BALLOC_PERCPU, n, threads));
+        printf(" %14.2f\n", scale_run(BALLOC_PERCPU | BALLOC_LOCKFREE, n, threads));
+    }
+    free(threads);
+    printf("\n");
+}
+
+// Standard workloads, run against balloc/bfree and against malloc/free. Run the binary as is to
+// compare w/glibc, or under LD_PRELOAD=libballoc.so (wrapper.c and heap.c) to compare w/the interposer.
+
+#define WORK_OPS  (1 << 20)         //allocator calls per workload
+#define WORK_LIVE 1024              //slots in each workload's live set
+#define RSS_EVERY (1 << 14)         //ops between RSS samples, on the timed pass only
+
+// Allocator structure: the three calls a workload makes
+typedef struct {
+    const char *name;
+    void *(*alloc)(size_t size);
+    void (*free)(void *mem);
+    void *(*realloc)(void *mem, size_t size);
+} Allocator;
+
+static Balloc work_pool;
+static double work_lat[WORK_OPS], consumer_lat[WORK_OPS];     //touched up front, so they don't count as RSS growth
+
+static void *pool_alloc(size_t size) { return balloc(work_pool, size); }
+static void pool_free(void *mem) { bfree(work_pool, mem); }
+static void *pool_realloc(void *mem, size_t size) { return brealloc(work_pool, mem, size); }
+static void sys_free(void *mem) { free(mem); }
+
+// Run structure: one pass of one workload on one thread
+typedef struct {
+    Allocator *a;
+    double *lat;                    //ns of each op, NULL on the untimed pass
+    size_t ops;                     //ops done so far
+    size_t peak;                    //highest RSS seen
+    unsigned int seed;
+} Run;
+
+static unsigned int rnd(Run *r) {
+    r->seed ^= r->seed << 13;
+    r->seed ^= r->seed >> 17;
+    r->seed ^= r->seed << 5;
+    return r->seed;
+}
+
+//note time of the op that started at start, and sample RSS now and then
+static void record(Run *r, double start) {
+    if (r->ops < WORK_OPS)
+        r->lat[r->ops] = now() - start;
+    if (r->ops % RSS_EVERY == 0) {
+        size_t resident = rss();
+        if (resident > r->peak)
+            r->peak = resident;
+    }
+}
+
+//one call to the allocator, timed if the pass is; the first byte of each new block is written
+static void *op_alloc(Run *r, size_t size) {
+    double start = r->lat ? now() : 0;
+    void *mem = r->a->alloc(size);
+    if (r->lat)
+        record(r, start);
+    r->ops++;
+    if (mem)
+        *(char *)mem = 1;
+    return mem;
+}
+
+static void op_free(Run *r, void *mem) {
+    double start = r->lat ? now() : 0;
+    r->a->free(mem);
+    if (r->lat)
+        record(r, start);
+    r->ops++;
+}
+
+static void *op_realloc(Run *r, void *mem, size_t size) {
+    double start = r->lat ? now() : 0;
+    void *new = r->a->realloc(mem, size);
+    if (r->lat)
+        record(r, start);
+    r->ops++;
+    return new;
+}
+
+//free what a workload left in its live set, untimed
+static void drain(Run *r, void **live, int n) {
+    for (int i = 0; i < n; i++) {
+        if (live[i])
+            r->a->free(live[i]);
+    }
+}
+
+//random slots flip between empty and one 64-byte block
+static void work_fixed(Run *r) {
+    void *live[WORK_LIVE] = {0};
+    while (r->ops < WORK_OPS) {
+        int slot = rnd(r) % WORK_LIVE;
+        if (live[slot]) {
+            op_free(r, live[slot]);
+            live[slot] = NULL;
+        } else {
+            live[slot] = op_alloc(r, 64);
+        }
+    }
+    drain(r, live, WORK_LIVE);
+}
+
+//random slots flip between empty and a block of 1 byte to 4 KiB, small sizes more likely
+static void work_random(Run *r) {
+    void *live[WORK_LIVE] = {0};
+    while (r->ops < WORK_OPS) {
+        int slot = rnd(r) % WORK_LIVE;
+        if (live[slot]) {
+            op_free(r, live[slot]);
+            live[slot] = NULL;
+        } else {
+            live[slot] = op_alloc(r, (rnd(r) % 64 + 1) << (rnd(r) % 7));
+        }
+    }
+    drain(r, live, WORK_LIVE);
+}
+
+//allocate a batch, then free it newest first, like a stack of scratch buffers
+static void work_lifo(Run *r) {
+    void *live[256];
+    while (r->ops < WORK_OPS) {
+        for (int i = 0; i < 256; i++)
+            live[i] = op_alloc(r, rnd(r) % 256 + 1);
+        for (int i = 255; i >= 0; i--)
+            op_free(r, live[i]);
+    }
+}
+
+//a queue: each new block is freed after WORK_LIVE more are allocated, oldest first
+static void work_fifo(Run *r) {
+    void *live[WORK_LIVE] = {0};
+    for (size_t i = 0; r->ops < WORK_OPS; i++) {
+        int slot = i % WORK_LIVE;
+        if (live[slot])
+            op_free(r, live[slot]);
+        live[slot] = op_alloc(r, rnd(r) % 256 + 1);
+    }
+    drain(r, live, WORK_LIVE);
+}
+
+//mostly small long-lived blocks, w/1 in 8 a short-lived 4 to 64 KiB one that the small ones' holes can't hold
+static void work_fragment(Run *r) {
+    void *live[4 * WORK_LIVE] = {0};
+    void *big[8] = {0};
+    while (r->ops < WORK_OPS) {
+        if (rnd(r) % 8 == 0) {
+            int slot = rnd(r) % 8;
+            if (big[slot])
+                op_free(r, big[slot]);
+            big[slot] = op_alloc(r, 4096 << (rnd(r) % 5));
+            continue;
+        }
+        int slot = rnd(r) % (4 * WORK_LIVE);
+        if (live[slot]) {
+            op_free(r, live[slot]);
+            live[slot] = NULL;
+        } else {
+            live[slot] = op_alloc(r, 16 + rnd(r) % 112);
+        }
+    }
+    drain(r, live, 4 * WORK_LIVE);
+    drain(r, big, 8);
+}
+
+//buffers that grow by half again, like a vector being appended to, until 64 KiB, then start over
+static void work_realloc(Run *r) {
+    void *buf[256] = {0};
+    size_t size[256] = {0};
+    for (size_t i = 0; r->ops < WORK_OPS; i++) {
+        int slot = i % 256;
+        if (buf[slot] && size[slot] < (64 << 10)) {
+            size[slot] += size[slot] / 2;
+            void *new = op_realloc(r, buf[slot], size[slot]);
+            if (new) {
+                buf[slot] = new;
+                ((char *)new)[size[slot] - 1] = 1;
+            }
+            continue;
+        }
+        if (buf[slot])
+            op_free(r, buf[slot]);
+        size[slot] = 16;
+        buf[slot] = op_alloc(r, size[slot]);
+    }
+    drain(r, buf, 256);
+}
+
+// Producer/consumer: one thread allocates blocks and hands them over a ring to another that frees them
+#define RING 1024
+
+static void *ring[RING];
+static size_t ring_head, ring_tail;
+
+static void *consumer(void *arg) {
+    Run *r = arg;
+    for (size_t tail = 0; ; tail++) {
+        size_t head;
+        while ((head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE)) == tail)
+            sched_yield();
+        void *mem = ring[tail % RING];
+        if (mem == NULL)
+            return NULL;    //producer is done
+        op_free(r, mem);
+        __atomic_store_n(&ring_tail, tail + 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void handover(void *mem, size_t head) {
+    while (head - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) == RING)
+        sched_yield();
+    ring[head % RING] = mem;
+    __atomic_store_n(&ring_head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void work_prodcons(Run *r) {
+    Run c = {r->a, r->lat ? consumer_lat : NULL, 0, 0, 1};
+    pthread_t t;
+
+    ring_head = ring_tail = 0;
+    pthread_create(&t, NULL, consumer, &c);
+    size_t head = 0;
+    while (r->ops < WORK_OPS / 2) {
+        void *mem = op_alloc(r, rnd(r) % 256 + 1);
+        if (mem)
+            handover(mem, head++);
+    }
+    handover(NULL, head);
+    pthread_join(t, NULL);
+
+    //both threads' ops count, the consumer's latencies go after the producer's
+    if (r->lat)
+        memcpy(r->lat + r->ops, consumer_lat, (c.ops < WORK_OPS - r->ops ? c.ops : WORK_OPS - r->ops) * sizeof(double));
+    r->ops += c.ops;
+    if (c.peak > r->peak)
+        r->peak = c.peak;
+}
+
+static int bydouble(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*  (1) run workload once untimed, for throughput
+    (2) run it again timing every op and sampling RSS, for percentiles and peak RSS
+    (3) the timer's own cost, the fastest of many empty reads, is taken off every op
+    w/balloc, each workload gets a fresh thread-safe, lazy, slab pool, so RSS starts from nothing
+*/
+static void workload(const char *name, void (*fn)(Run *), Allocator *a) {
+    double *lat = work_lat;
+    double overhead = 1e9;
+    for (int i = 0; i < 1000; i++) {
+        double start = now(), t = now() - start;
+        if (t < overhead)
+            overhead = t;
+    }
+
+    size_t before = rss();
+    if (a->alloc == pool_alloc)
+        work_pool = bcreatef((size_t)1 << 30, 4, 24, BALLOC_THREADSAFE | BALLOC_LAZY | BALLOC_SLAB);
+
+    Run r = {a, NULL, 0, before, 1};
+    double start = now();
+    fn(&r);
+    double elapsed = now() - start;
+    size_t ops = r.ops;
+
+    r = (Run){a, lat, 0, before, 1};
+    fn(&r);
+    size_t n = r.ops < WORK_OPS ? r.ops : WORK_OPS;
+    for (size_t i = 0; i < n; i++)
+        lat[i] = lat[i] > overhead ? lat[i] - overhead : 0;
+    qsort(lat, n, sizeof(double), bydouble);
+
+    printf("%10s %10s %10.2f %8.0f %8.0f %8.0f %8.0f %12zu\n", name, a->name, ops / elapsed * 1e3,
+           lat[n / 2], lat[n * 9 / 10], lat[n * 99 / 100], lat[n * 999 / 1000], (r.peak - before) / 1024);
+
+    if (a->alloc == pool_alloc)
+        bdelete(work_pool);
+}
+
+//ops/sec, ns/op percentiles and peak RSS growth for each workload, balloc vs. malloc
+void bench_workloads() {
+    printf("=== Bench: Standard Workloads ===\n");
+    printf("(malloc is %s)\n", getenv("LD_PRELOAD") ? getenv("LD_PRELOAD") : "the C library's");
+    printf("%10s %10s %10s %8s %8s %8s %8s %12s\n", "workload", "allocator", "Mops/s", "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "peak RSS KiB");
+
+    Allocator allocators[2] = {
+        {"balloc", pool_alloc, pool_free, pool_realloc},
+        {"malloc", malloc, sys_free, realloc},
+    };
+    const char *names[7] = {"fixed", "random", "lifo", "fifo", "prodcons", "fragment", "realloc"};
+    void (*fns[7])(Run *) = {work_fixed, work_random, work_lifo, work_fifo, work_prodcons, work_fragment, work_realloc};
+
+    memset(work_lat, 0, sizeof(work_lat));
+    memset(consumer_lat, 0, sizeof(consumer_lat));
+
+    for (int w = 0; w < 7; w++) {
+        for (int a = 0; a < 2; a++)
+            workload(names[w], fns[w], &allocators[a]);
+    }
+    printf("\n");
+}
+
+/*  (1) run workload on a fresh pool w/flags, once untimed, for throughput, and once timing every op
+    (2) splits and merges are counted over both passes, from bstats
+*/
+static void churn(const char *name, void (*fn)(Run *), int flags) {
+    static Allocator a = {"balloc", pool_alloc, pool_free, pool_realloc};
+    work_pool = bcreatef((size_t)1 << 30, 4, 24, BALLOC_LAZY | flags);
+
+    Run r = {&a, NULL, 0, 0, 1};
+    double start = now();
+    fn(&r);
+    double elapsed = now() - start;
+    size_t ops = r.ops;
+
+    r = (Run){&a, work_lat, 0, 0, 1};
+    fn(&r);
+    size_t n = r.ops < WORK_OPS ? r.ops : WORK_OPS;
+    qsort(work_lat, n, sizeof(double), bydouble);
+
+    BallocStats s;
+    bstats(work_pool, &s);
+    size_t splits = 0, merges = 0;
+    for (int e = 4; e <= 24; e++) {
+        splits += s.levels[e].splits;
+        merges += s.levels[e].merges;
+    }
+    printf("%10s %8s %10.2f %8.0f %8.0f %12zu %12zu\n", name, flags ? "deferred" : "eager", ops / elapsed * 1e3,
+           work_lat[n / 2], work_lat[n * 99 / 100], splits, merges);
+    bdelete(work_pool);
+}
+
+//the churning workloads, w/blocks coalesced on every free vs. w/BALLOC_DEFER
+void bench_defer() {
+    printf("=== Bench: Deferred Coalescing ===\n");
+    printf("%10s %8s %10s %8s %8s %12s %12s\n", "workload", "coalesce", "Mops/s", "p50 ns", "p99 ns", "splits", "merges");
+
+    const char *names[4] = {"fixed", "random", "lifo", "realloc"};
+    void (*fns[4])(Run *) = {work_fixed, work_random, work_lifo, work_realloc};
+    memset(work_lat, 0, sizeof(work_lat));
+    for (int w = 0; w < 4; w++) {
+        churn(names[w], fns[w], 0);
+        churn(names[w], fns[w], BALLOC_DEFER);
+    }
+    printf("\n");
+}
+
+#define RESTART_BLOCKS (1 << 18)
+#define RESTART_PATH   "/tmp/bench_balloc.snap"
+
+static size_t restart_offsets[RESTART_BLOCKS];
+
+//fill a fresh pool w/RESTART_BLOCKS blocks of 32 bytes to 4 KiB, each written through, as a cache would
+static Balloc restart_fill() {
+    Balloc pool = bcreatef((size_t)1 << 30, 4, 24, BALLOC_THREADSAFE | BALLOC_LAZY | BALLOC_SLAB);
+    srand(1);
+    for (int i = 0; i < RESTART_BLOCKS; i++) {
+        size_t size = 32 + rand() % 4065;
+        char *p = balloc(pool, size);
+        memset(p, i, size);
+        restart_offsets[i] = p - (char *)bbase(pool);
+    }
+    return pool;
+}
+
+//read one byte of every block, as a restarted cache serving its first requests would
+static long restart_touch(Balloc pool) {
+    long sum = 0;
+    for (int i = 0; i < RESTART_BLOCKS; i++)
+        sum += ((char *)bbase(pool))[restart_offsets[i]];
+    return sum;
+}
+
+/*  time to a usable pool after a restart: rebuilding every block from scratch, vs. bload of a bsave snapshot
+    bload is timed alone, and w/every block then touched, which pages the snapshot in
+    the snapshot was just written, so its pages come from the page cache, not the disk
+*/
+void bench_restart() {
+    printf("=== Bench: Warm Restart from a Snapshot ===\n");
+
+    double start = now();
+    Balloc pool = restart_fill();
+    double rebuild = now() - start;
+    BallocStats s;
+    bstats(pool, &s);
+
+    start = now();
+    int rc = bsave(pool, RESTART_PATH);
+    double save = now() - start;
+    bdelete(pool);
+    struct stat st;
+    if (rc || stat(RESTART_PATH, &st)) {
+        printf("could not save a snapshot to %s\n\n", RESTART_PATH);
+        return;
+    }
+
+    start = now();
+    pool = bload(RESTART_PATH);
+    double load = now() - start;
+    long f = faults();
+    long sum = restart_touch(pool);
+    double touched = now() - start;
+    f = faults() - f;
+
+    printf("%d blocks, %zu KiB live, snapshot %ld KiB on disk\n", RESTART_BLOCKS, s.live / 1024, (long)st.st_blocks / 2);
+    printf("%24s %12.2f ms\n", "rebuild from scratch", rebuild / 1e6);
+    printf("%24s %12.2f ms\n", "bsave", save / 1e6);
+    printf("%24s %12.2f ms\n", "bload", load / 1e6);
+    printf("%24s %12.2f ms (%ld page faults, checksum %ld)\n", "bload + touch all", touched / 1e6, f, sum);
+
+    bdelete(pool);
+    unlink(RESTART_PATH);
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *which = argc > 1 ? argv[1] : "all";
+
+    printf("Buddy System Allocator Benchmarks\n");
+    printf("==================================\n\n");
+
+    if (!strcmp(which, "all") || !strcmp(which, "free"))
+        bench_free_latency();
+    if (!strcmp(which, "all") || !strcmp(which, "levels"))
+        bench_levels();
+    if (!strcmp(which, "all") || !strcmp(which, "create"))
+        bench_create();
+    if (!strcmp(which, "all") || !strcmp(which, "trim"))
+        bench_trim();
+    if (!strcmp(which, "all") || !strcmp(which, "threads"))
+        bench_thread_scaling();
+    if (!strcmp(which, "all") || !strcmp(which, "lockfree"))
+        bench_lockfree();
+    if (!strcmp(which, "all") || !strcmp(which, "percpu"))
+        bench_percpu();
+    if (!strcmp(which, "all") || !strcmp(which, "bulk"))
+        bench_bulk();
+    if (!strcmp(which, "all") || !strcmp(which, "tree"))
+        bench_engines();
+    if (!strcmp(which, "all") || !strcmp(which, "slab"))
+        bench_slab();
+    if (!strcmp(which, "all") || !strcmp(which, "calloc"))
+        bench_calloc();
+    if (!strcmp(which, "all") || !strcmp(which, "workloads"))
+        bench_workloads();
+    if (!strcmp(which, "all") || !strcmp(which, "restart"))
+        bench_restart();
+    if (!strcmp(which, "all") || !strcmp(which, "defer"))
+        bench_defer();
+
+    return 0;
+}
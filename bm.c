@@ -4,47 +4,185 @@
 #include "bm.h"
 #include "utils.h"
 
+// Bits live in 64-bit words, bit i in word i/64 at position i%64, so
+// scans and range operations touch a word at a time. The bit count is
+// stored in the size_t just before the first word.
+
+typedef unsigned long Word;
+
+static const size_t wordbits=sizeof(Word)*8;
+
+static Word *words(BM b) { return b; }
+
 static size_t bmbits(BM b) { size_t *bits=b; return *--bits; }
 
-static size_t bmbytes(BM b) { return bits2bytes(bmbits(b)); }
+static size_t bitbytes(BM b) { return bits2bytes(bmbits(b)); }
 
+// mask of bits [from,to) within one word, 0<=from<to<=wordbits
+static Word span(size_t from, size_t to) {
+  Word hi=to==wordbits ? ~0UL : (1UL<<to)-1;
+  return hi&~((1UL<<from)-1);
+}
+
+#ifdef NDEBUG
+static void ok(BM b, size_t i) { (void)b; (void)i; }
+#else
 static void ok(BM b, size_t i) {
   if (i<bmbits(b))
     return;
   fprintf(stderr,"bitmap index out of range\n");
   exit(1);
-}         
+}
+#endif
 
-extern BM bmcreate(size_t bits) {
-  size_t bytes=bits2bytes(bits);
-  size_t *p=mmalloc(sizeof(size_t)+bytes);
-  if ((long)p==-1)
-    return 0;
+// Bytes a bitmap of bits bits takes, count included, so a caller can
+// lay one out w/bminit in memory of its own, which must be zero.
+
+extern size_t bmbytes(size_t bits) {
+  return sizeof(size_t)+divup(bits,wordbits)*sizeof(Word);
+}
+
+extern BM bminit(void *mem, size_t bits) {
+  size_t *p=mem;
   *p=bits;
   BM b=++p;
-  memset(b,0,bytes);
   return b;
 }
 
-extern void bmdelete(BM b) {
-  size_t *p=b;
-  p--;
-  mmfree(p,sizeof(size_t)+bits2bytes(*p));
+// Copy from's bits into to, which must be at least as long.
+
+extern void bmcopy(BM to, BM from) {
+  memcpy(words(to),words(from),divup(bmbits(from),wordbits)*sizeof(Word));
 }
 
 extern void bmset(BM b, size_t i) {
-  ok(b,i); bitset(b+i/bitsperbyte,i%bitsperbyte);
+  ok(b,i); words(b)[i/wordbits]|=1UL<<(i%wordbits);
 }
 
 extern void bmclr(BM b, size_t i) {
-  ok(b,i); bitclr(b+i/bitsperbyte,i%bitsperbyte);
+  ok(b,i); words(b)[i/wordbits]&=~(1UL<<(i%wordbits));
+}
+
+extern void bmflip(BM b, size_t i) {
+  ok(b,i); words(b)[i/wordbits]^=1UL<<(i%wordbits);
 }
 
 extern int bmtst(BM b, size_t i) {
-  ok(b,i); return bittst(b+i/bitsperbyte,i%bitsperbyte);
+  ok(b,i);
+  Word word=__atomic_load_n(&words(b)[i/wordbits],__ATOMIC_RELAXED);
+  return (word>>(i%wordbits))&1;
+}
+
+// Test-and-set and test-and-clear, returning the bit's old value.
+// Ordered acquire-release, so they can hand memory from one thread to
+// another in lock-free protocols.
+
+extern int bmtas(BM b, size_t i) {
+  ok(b,i);
+  Word mask=1UL<<(i%wordbits);
+  return (__atomic_fetch_or(&words(b)[i/wordbits],mask,__ATOMIC_ACQ_REL)&mask)!=0;
+}
+
+extern int bmtac(BM b, size_t i) {
+  ok(b,i);
+  Word mask=1UL<<(i%wordbits);
+  return (__atomic_fetch_and(&words(b)[i/wordbits],~mask,__ATOMIC_ACQ_REL)&mask)!=0;
+}
+
+// In one atomic step, clear bit take and return 1 if it is set, or
+// else set bit set and return 0. Both bits must share a word, as a
+// buddy pair does.
+
+extern int bmtakeorset(BM b, size_t take, size_t set) {
+  ok(b,take); ok(b,set);
+  Word *word=&words(b)[set/wordbits];
+  Word tmask=1UL<<(take%wordbits), smask=1UL<<(set%wordbits);
+  Word old=__atomic_load_n(word,__ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(word,&old,old&tmask ? old&~tmask : old|smask,1,
+                                      __ATOMIC_ACQ_REL,__ATOMIC_RELAXED))
+    ;
+  return (old&tmask)!=0;
+}
+
+// Set or clear bits [i,i+n). Partial words at the edges are changed
+// atomically; whole words in between are only written when not
+// already in the wanted state, and must not be shared with bits
+// another thread changes.
+
+static void range(BM b, size_t i, size_t n, int set) {
+  if (n==0)
+    return;
+  ok(b,i+n-1);
+  Word *word=&words(b)[i/wordbits];
+  size_t from=i%wordbits, left=n;
+  for (;;) {
+    size_t to=from+left<wordbits ? from+left : wordbits;
+    Word mask=span(from,to);
+    Word old=__atomic_load_n(word,__ATOMIC_RELAXED);
+    if (mask==~0UL) {
+      if (old!=(set ? ~0UL : 0))
+        __atomic_store_n(word,set ? ~0UL : 0,__ATOMIC_RELAXED);
+    } else if (set && (old&mask)!=mask) {
+      __atomic_fetch_or(word,mask,__ATOMIC_RELAXED);
+    } else if (!set && (old&mask)) {
+      __atomic_fetch_and(word,~mask,__ATOMIC_RELAXED);
+    }
+    left-=to-from;
+    if (!left)
+      return;
+    from=0;
+    word++;
+  }
+}
+
+extern void bmsetrange(BM b, size_t i, size_t n) { range(b,i,n,1); }
+
+extern void bmclrrange(BM b, size_t i, size_t n) { range(b,i,n,0); }
+
+// Find the first set bit in [i,end), a word at a time; flip is all
+// ones when looking for a clear bit. Returns end if there is none.
+
+static size_t find(BM b, size_t i, size_t end, Word flip) {
+  if (end>bmbits(b))
+    end=bmbits(b);
+  if (i>=end)
+    return end;
+  Word *word=&words(b)[i/wordbits];
+  Word *last=&words(b)[(end-1)/wordbits];
+  Word w=(__atomic_load_n(word,__ATOMIC_RELAXED)^flip)&~((1UL<<(i%wordbits))-1);
+  for (;;) {
+    if (w) {
+      size_t found=(word-words(b))*wordbits+__builtin_ctzl(w);
+      return found<end ? found : end;
+    }
+    if (word==last)
+      return end;
+    w=__atomic_load_n(++word,__ATOMIC_RELAXED)^flip;
+  }
+}
+
+extern size_t bmffs(BM b, size_t i, size_t end) { return find(b,i,end,0); }
+
+extern size_t bmffc(BM b, size_t i, size_t end) { return find(b,i,end,~0UL); }
+
+extern size_t bmcount(BM b, size_t i, size_t n) {
+  if (n==0)
+    return 0;
+  ok(b,i+n-1);
+  Word *word=&words(b)[i/wordbits];
+  size_t from=i%wordbits, count=0;
+  for (;;) {
+    size_t to=from+n<wordbits ? from+n : wordbits;
+    count+=__builtin_popcountl(__atomic_load_n(word,__ATOMIC_RELAXED)&span(from,to));
+    n-=to-from;
+    if (!n)
+      return count;
+    from=0;
+    word++;
+  }
 }
 
 extern void bmprt(BM b) {
-  for (int byte=bmbytes(b)-1; byte>=0; byte--)
-    printf("%02x%s",((char *)b)[byte],(byte ? " " : "\n"));
+  for (long byte=bitbytes(b)-1; byte>=0; byte--)
+    printf("%02x%s",((unsigned char *)b)[byte],(byte ? " " : "\n"));
 }
@@ -7,13 +7,26 @@
 
 typedef void *BM;
 
-extern BM   bmcreate(size_t bits);
-extern void bmdelete(BM b);
+extern size_t bmbytes(size_t bits);
+extern BM     bminit(void *mem, size_t bits);
+extern void   bmcopy(BM to, BM from);
 
 extern void bmset(BM b, size_t i);
 extern void bmclr(BM b, size_t i);
+extern void bmflip(BM b, size_t i);
 extern int  bmtst(BM b, size_t i);
 
+extern int  bmtas(BM b, size_t i);
+extern int  bmtac(BM b, size_t i);
+extern int  bmtakeorset(BM b, size_t take, size_t set);
+extern void bmsetrange(BM b, size_t i, size_t n);
+extern void bmclrrange(BM b, size_t i, size_t n);
+
+// Scans look in [i,end) and return the index found, or end if there is none.
+extern size_t bmffs(BM b, size_t i, size_t end);
+extern size_t bmffc(BM b, size_t i, size_t end);
+extern size_t bmcount(BM b, size_t i, size_t n);
+
 extern void bmprt(BM b);
 
 #endif
@@ -1,5 +1,5 @@
 /* Author: Zella Running
- * Description: Maintains a free list for each block size. Stores pointers in the forst bytes of free blocks, and each free block points to the next free block of same size.
+ * Description: Maintains a free list for each block size. Stores links in the first bytes of free blocks, and each free block points to the next and previous free blocks of same size, so any block can be unlinked in constant time. Links are offsets from the pool's base, so a list reads the same wherever the pool is mapped.
  * Class: CS 451 - HW2 Memory Allocator w/Buddy System
  * Date: 2026 February 11
  */
@@ -9,31 +9,75 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-/*  (1) make count
-    (2) allocate array of void* of size count, initialized to NULL
-    (3) return pointer to array
-*/
-extern FreeList freelistcreate(size_t size, int l, int u){
-    (void)size;
-    int count = u - l + 1;
-    void **lists = mmalloc(count * sizeof(void *));
-    if((long)lists == 1)
-        return NULL;
+// Link: offset of a free block from base, plus one, so 0 still ends a list
+typedef size_t Link;
+
+// Node structure: overlays the first bytes of every free block
+typedef struct {
+    Link next;              //next free block of same size
+    Link prev;              //previous free block of same size, 0 for head
+} Node;
+
+// Head structure: one per level, padded to its own cache line so levels locked separately don't share one
+typedef struct {
+    Link first;             //first free block, 0 when empty
+} __attribute__((aligned(64))) Head;
+
+// Lists structure: one head per level, plus a summary of which levels are non-empty
+// the mask is shared by all levels, so it is only changed with atomic operations
+typedef struct {
+    unsigned long mask;     //bit e-l is set when level e's list is non-empty
+    Head heads[];           //head of each level's list
+} Lists;
+
+//block a link points to, or NULL for 0
+static Node *node(void *base, Link link){
+    return link ? base + link - 1 : NULL;
+}
 
-    //initialize all lists to empty
-    for (int i = 0; i < count; i++){
-        lists[i] = NULL;
-    }
+//link to block, or 0 for NULL
+static Link linkto(void *base, Node *block){
+    return block ? (size_t)((void *)block - base) + 1 : 0;
+}
+
+//mark level index non-empty
+static void markfull(Lists *lists, int index){
+    __atomic_fetch_or(&lists->mask, 1UL << index, __ATOMIC_RELAXED);
+}
 
+//mark level index empty
+static void markempty(Lists *lists, int index){
+    __atomic_fetch_and(&lists->mask, ~(1UL << index), __ATOMIC_RELAXED);
+}
+
+//bytes of a lists structure for levels l..u
+extern size_t freelistbytes(int l, int u){
+    return sizeof(Lists) + (u - l + 1) * sizeof(Head);
+}
+
+/*  (1) lay out lists structure in mem, which holds freelistbytes(l, u)
+    (2) initialize all lists to empty
+    (3) return pointer to lists
+*/
+extern FreeList freelistinit(void *mem, int l, int u){
+    Lists *lists = mem;
+    lists->mask = 0;
+    for (int i = 0; i < u - l + 1; i++){
+        lists->heads[i].first = 0;
+    }
     return lists;
 }
 
-/*  (1) free array of void*
-    (2) return nothing
+/*  (1) drop levels below e from the summary mask
+    (2) count trailing zeros to find the first non-empty level at or above e
+    (3) return that level, or -1 if every level from e up is empty
 */
-extern void freelistdelete(FreeList f, int l, int u){
-    int count = u - l +1;
-    mmfree(f, count * sizeof(void *));
+extern int freelistfind(FreeList f, int e, int l){
+    Lists *lists = f;
+    unsigned long above = __atomic_load_n(&lists->mask, __ATOMIC_RELAXED) >> (e - l);
+    if (above == 0)
+        return -1;
+    return e + __builtin_ctzl(above);
 }
 
 /*  (1) check free list for level e for available block
@@ -41,16 +85,21 @@ extern void freelistdelete(FreeList f, int l, int u){
     (3) if not found, return NULL
 */
 extern void *freelistalloc(FreeList f, void *base, int e, int l){
-    (void)base;
-    void **lists = f;
+    Lists *lists = f;
     int index = e - l;
-    
-    void *block = lists[index];
+
+    Node *block = node(base, lists->heads[index].first);
     if (block == NULL)
         return NULL;
 
-    void *next = *(void **)block;
-    lists[index] = next;
+    lists->heads[index].first = block->next;
+    if (block->next)
+        node(base, block->next)->prev = 0;
+    else
+        markempty(lists, index);
+
+    //leave no stale links behind, so a block's bytes are only non-zero where its owner wrote them
+    block->next = 0;
 
     return block;
 }
@@ -59,15 +108,57 @@ extern void *freelistalloc(FreeList f, void *base, int e, int l){
     (2) return nothing
 */
 extern void freelistfree(FreeList f, void *base, void *mem, int e, int l){
-    (void)base;
-    void **lists = f;
+    Lists *lists = f;
     int index = e - l;
+    Node *block = mem;
 
-    //store pointer to current head in this block
-    *(void **)mem = lists[index];
+    //link this block in front of current head
+    block->next = lists->heads[index].first;
+    block->prev = 0;
+    if (block->next)
+        node(base, block->next)->prev = linkto(base, block);
+    else
+        markfull(lists, index);
 
     //make this block the new head
-    lists[index] = mem;
+    lists->heads[index].first = linkto(base, block);
+}
+
+/*  (1) unlink block from free list for level e, using its own links
+    (2) return nothing
+*/
+extern void freelistremove(FreeList f, void *base, void *mem, int e, int l){
+    Lists *lists = f;
+    int index = e - l;
+    Node *block = mem;
+
+    if (block->prev)
+        node(base, block->prev)->next = block->next;
+    else
+        lists->heads[index].first = block->next;
+    if (block->next)
+        node(base, block->next)->prev = block->prev;
+    else if (block->prev == 0)
+        markempty(lists, index);
+
+    block->next = 0;
+    block->prev = 0;
+}
+
+/*  (1) return first block on level e's free list, or NULL if empty
+    (2) caller must keep the list from changing while it walks it
+*/
+extern void *freelistfirst(FreeList f, void *base, int e, int l){
+    Lists *lists = f;
+    return node(base, lists->heads[e - l].first);
+}
+
+/*  (1) return block after mem on its free list, or NULL at the end
+*/
+extern void *freelistnext(FreeList f, void *base, void *mem){
+    (void)f;
+    Node *block = mem;
+    return node(base, block->next);
 }
 
 /*  (1) check if block is in free list for level e
@@ -87,20 +178,20 @@ extern int freelistsize(FreeList f, void *base, void *mem, int l, int u){
 /*  (1) print free list for each level from l to u, showing addresses of free blocks
     (2) return nothing
 */
-extern void freelistprint(FreeList f, int l, int u){
-    void **lists = f;
+extern void freelistprint(FreeList f, void *base, int l, int u){
+    Lists *lists = f;
 
-    for (int e = l; e < u; e++){
+    for (int e = l; e <= u; e++){
          int index = e - l;
-         printf("Free list[2%d} (size %4lu): ", e, e2size(e));
+         printf("Free list[2^%d] (size %4lu): ", e, e2size(e));
          
-        void *block = lists[index];
+        Node *block = node(base, lists->heads[index].first);
         if (block == NULL){
             printf("empty\n");
         } else {
             while (block != NULL){
-                printf("%p -> ", block);
-                block = *(void **)block;
+                printf("%p -> ", (void *)block);
+                block = node(base, block->next);
             }
             printf("NULL\n");
         }
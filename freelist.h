@@ -5,13 +5,18 @@
 
 typedef void *FreeList;
 
-extern FreeList freelistcreate(size_t size, int l, int u);
-extern void     freelistdelete(FreeList f, int l, int u);
+extern size_t   freelistbytes(int l, int u);
+extern FreeList freelistinit(void *mem, int l, int u);
 
+extern int   freelistfind(FreeList f, int e, int l);
 extern void *freelistalloc(FreeList f, void *base, int e, int l);
 extern void  freelistfree(FreeList f, void *base, void *mem, int e, int l);
+extern void  freelistremove(FreeList f, void *base, void *mem, int e, int l);
+
+extern void *freelistfirst(FreeList f, void *base, int e, int l);
+extern void *freelistnext(FreeList f, void *base, void *mem);
 
 extern int freelistsize(FreeList f, void *base, void *mem, int l, int u);
-extern void freelistprint(FreeList f, int l, int u);
+extern void freelistprint(FreeList f, void *base, int l, int u);
 
 #endif
@@ -0,0 +1,510 @@
+/* Author: Zella Running
+ * Description: Growable heap for the malloc wrapper. Adds 2^u buddy arenas on demand, sends requests bigger than 2^u to their own mmap regions, and finds the owner of any pointer through a two-level page map.
+ * Class: CS 451 - HW2 Memory Allocator w/Buddy System
+ * Date: 2026 February 11
+ */
+#include "heap.h"
+#include "balloc.h"
+#include "bm.h"
+#include "utils.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define PAGESHIFT 12                        //page map granularity, 4 KiB
+#define ADDRBITS  48                        //user addresses fit in 48 bits
+#define LEAFBITS  18                        //page numbers per leaf, 2^18
+#define ROOTBITS  (ADDRBITS - PAGESHIFT - LEAFBITS)
+#define CHUNKBITS 12                        //arenas per chunk, 2^12
+#define DIRBITS   16                        //chunks per heap, 2^16: 2^28 arenas, more than 48 bits hold once u >= 20
+#define CHUNK     (1 << CHUNKBITS)
+
+// Page map entry: 0 for pages we don't own, an Arena for arena pages (cache line aligned, low bit 0),
+// or (pages << 1) | 1 on the first page of a large region
+typedef uintptr_t Entry;
+
+// Arena structure: one 2^u buddy pool, and how big a block it may still have free
+// padded to its own cache line, since frees into different arenas write their own
+typedef struct {
+    Balloc pool;                    //the arena's pool
+    int room;                       //largest order that may be free, below l once full; a hint, never too low for long
+    int index;                      //position in creation order, and of its bit in the open maps
+} __attribute__((aligned(64))) Arena;
+
+// Chunk structure: CHUNK arenas in creation order, and a bit for each that may have room, never moved once made
+typedef struct {
+    Arena arenas[CHUNK];
+    BM open;                        //bit i set when arena i's room is at least l
+} Chunk;
+
+// Heap structure: chunks of arenas, and the page map that finds them
+typedef struct {
+    int l, u;                       //min and max exponent of every arena
+    pthread_mutex_t grow;           //serializes adding arenas, chunks and page map leaves
+    int narenas;                    //arenas created so far, read without the lock
+    int hint;                       //arena that last satisfied an allocation
+    Chunk **chunks;                 //2^DIRBITS chunk pointers, chunks made on demand
+    Entry **root;                   //2^ROOTBITS leaf pointers, leaves made on demand
+} HeapT;
+
+//bytes of a chunk, its open map included
+static size_t chunkbytes(void){
+    return sizeof(Chunk) + bmbytes(CHUNK);
+}
+
+//arena number i, which must have been created
+static Arena *arena(HeapT *h, int i){
+    return &h->chunks[i >> CHUNKBITS]->arenas[i & (CHUNK - 1)];
+}
+
+//open map holding arena a's bit
+static BM openmap(HeapT *h, Arena *a){
+    return h->chunks[a->index >> CHUNKBITS]->open;
+}
+
+/*  (1) split page number of mem into root and leaf index
+    (2) return pointer to its entry, creating the leaf if asked to, or NULL if there is none
+    only called with create set while holding the grow lock
+*/
+static Entry *entry(HeapT *h, void *mem, int create){
+    uintptr_t page = (uintptr_t)mem >> PAGESHIFT;
+    if (page >> (ROOTBITS + LEAFBITS))
+        return NULL;
+
+    Entry **slot = &h->root[page >> LEAFBITS];
+    Entry *leaf = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (!leaf && create){
+        leaf = mmalloc(sizeof(Entry) << LEAFBITS);
+        if ((long)leaf == -1)
+            return NULL;
+        __atomic_store_n(slot, leaf, __ATOMIC_RELEASE);
+    }
+    return leaf ? &leaf[page & ((1UL << LEAFBITS) - 1)] : NULL;
+}
+
+//look up the owner of mem, 0 if the heap doesn't own it
+static Entry lookup(HeapT *h, void *mem){
+    Entry *ent = entry(h, mem, 0);
+    Entry owner = ent ? __atomic_load_n(ent, __ATOMIC_ACQUIRE) : 0;
+
+    //large regions are only ever handed out by their first byte
+    if ((owner & 1) && ((uintptr_t)mem & (e2size(PAGESHIFT) - 1)))
+        return 0;
+    return owner;
+}
+
+/*  (1) point the entries for pages [mem, mem+size) at owner, making leaves as needed
+    (2) return 0 on success, -1 if a leaf could not be made
+*/
+static int enter(HeapT *h, void *mem, size_t size, Entry owner){
+    for (size_t off = 0; off < size; off += e2size(PAGESHIFT)){
+        Entry *ent = entry(h, mem + off, 1);
+        if (!ent)
+            return -1;
+        __atomic_store_n(ent, owner, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+/*  (1) create heap structure, the chunk directory and the page map root, no arenas yet
+    (2) return pointer to heap, or NULL on failure
+*/
+extern Heap heapcreate(int l, int u){
+    HeapT *h = mmalloc(sizeof(HeapT));
+    if ((long)h == -1)
+        return NULL;
+
+    h->chunks = mmalloc(sizeof(Chunk *) << DIRBITS);
+    if ((long)h->chunks == -1){
+        mmfree(h, sizeof(HeapT));
+        return NULL;
+    }
+    h->root = mmalloc(sizeof(Entry *) << ROOTBITS);
+    if ((long)h->root == -1){
+        mmfree(h->chunks, sizeof(Chunk *) << DIRBITS);
+        mmfree(h, sizeof(HeapT));
+        return NULL;
+    }
+
+    h->l = l;
+    h->u = u;
+    h->narenas = 0;
+    h->hint = 0;
+    pthread_mutex_init(&h->grow, NULL);
+    return h;
+}
+
+/*  (1) unmap large regions found in the page map, then the leaves
+    (2) delete every arena, then the chunks, then heap structure
+    (3) return nothing
+*/
+extern void heapdelete(Heap heap){
+    HeapT *h = heap;
+
+    for (size_t r = 0; r < (1UL << ROOTBITS); r++){
+        Entry *leaf = h->root[r];
+        if (!leaf)
+            continue;
+        for (size_t i = 0; i < (1UL << LEAFBITS); i++){
+            if (leaf[i] & 1)
+                mmfree((void *)(((r << LEAFBITS) | i) << PAGESHIFT), (leaf[i] >> 1) << PAGESHIFT);
+        }
+        mmfree(leaf, sizeof(Entry) << LEAFBITS);
+    }
+    mmfree(h->root, sizeof(Entry *) << ROOTBITS);
+
+    for (int i = 0; i < h->narenas; i++){
+        bdelete(arena(h, i)->pool);
+    }
+    for (int c = 0; c << CHUNKBITS < h->narenas; c++){
+        mmfree(h->chunks[c], chunkbytes());
+    }
+    mmfree(h->chunks, sizeof(Chunk *) << DIRBITS);
+    pthread_mutex_destroy(&h->grow);
+    mmfree(h, sizeof(HeapT));
+}
+
+/*  (1) map a region of whole pages just for this request, aligned to align if that's more than a page
+    (2) record its page count on its first page
+    (3) return pointer to region, or NULL on failure
+*/
+static void *largealloc(HeapT *h, size_t size, size_t align){
+    size_t pages = divup(size, e2size(PAGESHIFT));
+    void *mem = mmalign(pages << PAGESHIFT, size2e(align));
+    if ((long)mem == -1)
+        return NULL;
+
+    pthread_mutex_lock(&h->grow);
+    int rc = enter(h, mem, 1, (pages << 1) | 1);
+    pthread_mutex_unlock(&h->grow);
+    if (rc){
+        mmfree(mem, pages << PAGESHIFT);
+        return NULL;
+    }
+    return mem;
+}
+
+//make a chunk w/no arenas, or return NULL on failure
+static Chunk *newchunk(void){
+    Chunk *chunk = mmalloc(chunkbytes());
+    if ((long)chunk == -1)
+        return NULL;
+    chunk->open = bminit(chunk + 1, CHUNK);
+    return chunk;
+}
+
+/*  (1) under the grow lock, give up if another thread already added an arena since seen was read
+    (2) otherwise make the chunk it goes in if it starts one, create a 2^u arena, and point all of its pages at it
+    (3) mark it open, then publish it
+    (4) return 0 if there is a new arena to try, -1 if the heap is out of room, or has 2^(DIRBITS+CHUNKBITS) arenas
+*/
+static int grow(HeapT *h, int seen){
+    int rc = 0;
+    pthread_mutex_lock(&h->grow);
+    if (h->narenas == seen){
+        int c = seen >> CHUNKBITS;
+        Chunk *chunk = c < (1 << DIRBITS) ? h->chunks[c] : NULL;
+        if (c < (1 << DIRBITS) && !chunk && (chunk = newchunk()) != NULL)
+            h->chunks[c] = chunk;
+
+        Arena *a = chunk ? &chunk->arenas[seen & (CHUNK - 1)] : NULL;
+        Balloc pool = a ? bcreatef(e2size(h->u), h->l, h->u, BALLOC_THREADSAFE | BALLOC_LAZY) : NULL;
+        if (pool && enter(h, bbase(pool), e2size(h->u), (Entry)a) == 0){
+            a->pool = pool;
+            a->room = h->u;
+            a->index = seen;
+            bmtas(chunk->open, seen & (CHUNK - 1));
+            __atomic_store_n(&h->hint, seen, __ATOMIC_RELAXED);
+            __atomic_store_n(&h->narenas, seen + 1, __ATOMIC_RELEASE);
+        } else {
+            if (pool)
+                bdelete(pool);
+            rc = -1;
+        }
+    }
+    pthread_mutex_unlock(&h->grow);
+    return rc;
+}
+
+/*  (1) a block of 2^room or more may have been freed into a, so raise its room to u
+    (2) reopen it if it was full
+*/
+static void opened(HeapT *h, Arena *a){
+    if (__atomic_load_n(&a->room, __ATOMIC_SEQ_CST) == h->u)
+        return;
+    if (__atomic_exchange_n(&a->room, h->u, __ATOMIC_SEQ_CST) < h->l)
+        bmtas(openmap(h, a), a->index & (CHUNK - 1));
+}
+
+//block from a, zeroed if asked to, or NULL if it has none
+static void *take(Arena *a, size_t size, size_t align, int zero){
+    return zero ? bcalloc(a->pool, 1, size) : balloc_aligned(a->pool, size, align);
+}
+
+/*  (1) skip a if its room is below e
+    (2) if it has no block, lower its room below e, and close it if that leaves no room at all;
+        then try once more, so a block freed after the first try but before the room was lowered isn't missed,
+        since any free after that sees the lowered room and raises it again
+    (3) a close checks the room again once the bit is clear, in case a free raised it in between
+    (4) return pointer to block, or NULL
+*/
+static void *tryarena(HeapT *h, Arena *a, int e, size_t size, size_t align, int zero){
+    int room = __atomic_load_n(&a->room, __ATOMIC_SEQ_CST);
+    if (room < e)
+        return NULL;
+    void *mem = take(a, size, align, zero);
+    if (mem)
+        return mem;
+
+    if (!__atomic_compare_exchange_n(&a->room, &room, e - 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        return NULL;
+    if (e - 1 < h->l){
+        bmtac(openmap(h, a), a->index & (CHUNK - 1));
+        if (__atomic_load_n(&a->room, __ATOMIC_SEQ_CST) >= h->l)
+            bmtas(openmap(h, a), a->index & (CHUNK - 1));
+    }
+    mem = take(a, size, align, zero);
+    if (mem)
+        opened(h, a);
+    return mem;
+}
+
+/*  (1) try each open arena numbered from..to-1, a word of open bits at a time; full arenas are never looked at
+    (2) return pointer to block, w/the arena it came from made the hint, or NULL if none had room
+*/
+static void *scan(HeapT *h, int from, int to, int e, size_t size, size_t align, int zero){
+    while (from < to){
+        int c = from >> CHUNKBITS;
+        BM open = h->chunks[c]->open;
+        size_t end = to - (c << CHUNKBITS) < CHUNK ? (size_t)(to - (c << CHUNKBITS)) : CHUNK;
+        for (size_t i = bmffs(open, from & (CHUNK - 1), end); i < end; i = bmffs(open, i + 1, end)){
+            void *mem = tryarena(h, arena(h, (c << CHUNKBITS) + i), e, size, align, zero);
+            if (mem){
+                __atomic_store_n(&h->hint, (c << CHUNKBITS) + (int)i, __ATOMIC_RELAXED);
+                return mem;
+            }
+        }
+        from = (c + 1) << CHUNKBITS;
+    }
+    return NULL;
+}
+
+/*  (1) try the arena that last had room, then the open arenas after it, wrapping around,
+        skipping any whose room is too small
+    (2) if none has room, add an arena and try again
+    (3) return pointer to block, or NULL if the heap can't grow
+*/
+static void *arenaalloc(HeapT *h, size_t size, size_t align, int zero){
+    int e = size2e(size < align ? align : size);
+    if (e < h->l)
+        e = h->l;
+
+    for (;;){
+        int n = __atomic_load_n(&h->narenas, __ATOMIC_ACQUIRE);
+        int hint = __atomic_load_n(&h->hint, __ATOMIC_RELAXED);
+        if (hint >= n)
+            hint = 0;
+        void *mem = n ? tryarena(h, arena(h, hint), e, size, align, zero) : NULL;
+        if (!mem)
+            mem = scan(h, hint + 1, n, e, size, align, zero);
+        if (!mem)
+            mem = scan(h, 0, hint, e, size, align, zero);
+        if (mem)
+            return mem;
+        if (grow(h, n))
+            return NULL;
+    }
+}
+
+/*  (1) reject an alignment that isn't a power of two
+    (2) send requests bigger than 2^u, or aligned more strictly, to their own region
+    (3) otherwise allocate from the arenas
+    (4) return pointer to block, or NULL if the heap can't grow
+*/
+extern void *heapalign(Heap heap, size_t size, size_t align){
+    HeapT *h = heap;
+
+    if (size == 0 || align == 0 || (align & (align - 1)))
+        return NULL;
+    if (size > e2size(h->u) || align > e2size(h->u))
+        return largealloc(h, size, align);
+    return arenaalloc(h, size, align, 0);
+}
+
+/*  (1) check n * size for overflow
+    (2) a large region is fresh from mmap, so already zero
+    (3) an arena block is cleared only where its pages may have been written
+    (4) return pointer to zeroed memory, or NULL on failure
+*/
+extern void *heapcalloc(Heap heap, size_t n, size_t size){
+    HeapT *h = heap;
+
+    if (size && n > (size_t)-1 / size)
+        return NULL;
+    size *= n;
+    if (size == 0)
+        return NULL;
+    if (size > e2size(h->u))
+        return largealloc(h, size, 1);
+    return arenaalloc(h, size, 1, 1);
+}
+
+//allocate size bytes w/no alignment beyond what every block has
+extern void *heapalloc(Heap heap, size_t size){
+    return heapalign(heap, size, 1);
+}
+
+/*  (1) take one block as heapalloc does, from the arena that has room
+    (2) then as many more as that arena has in one balloc_bulk, and go back to (1) for the rest
+        a block bigger than an arena is a region of its own, so those come one at a time
+    (3) return number of blocks put in out, fewer than n only if the heap can't grow
+*/
+extern size_t heapalloc_bulk(Heap heap, size_t size, size_t n, void **out){
+    HeapT *h = heap;
+    size_t got = 0;
+
+    while (got < n && (out[got] = heapalloc(h, size)) != NULL){
+        Entry owner = lookup(h, out[got++]);
+        if (!(owner & 1))
+            got += balloc_bulk(((Arena *)owner)->pool, size, n - got, out + got);
+    }
+    return got;
+}
+
+/*  (1) find owner of mem in page map
+    (2) free block in its arena, or unmap its large region
+    (3) ignore pointers the heap doesn't own
+*/
+extern void heapfree(Heap heap, void *mem){
+    HeapT *h = heap;
+
+    Entry owner = lookup(h, mem);
+    if (owner == 0)
+        return;
+
+    if (owner & 1){
+        //only the first page of a large region has an entry, so mem is that page
+        Entry *ent = entry(h, mem, 0);
+        __atomic_store_n(ent, 0, __ATOMIC_RELEASE);
+        mmfree(mem, (owner >> 1) << PAGESHIFT);
+    } else {
+        bfree(((Arena *)owner)->pool, mem);
+        opened(h, (Arena *)owner);
+    }
+}
+
+//compare block addresses, for qsort
+static int byaddress(const void *a, const void *b){
+    void *x = *(void * const *)a;
+    void *y = *(void * const *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*  (1) sort mem by address, so each arena's blocks, which all lie in its 2^u, are one run
+    (2) give each run back to its arena in one bfree_bulk, and free anything else one block at a time
+    (3) return nothing, mem's contents are left in unspecified order
+*/
+extern void heapfree_bulk(Heap heap, void **mem, size_t n){
+    HeapT *h = heap;
+
+    qsort(mem, n, sizeof(void *), byaddress);
+    for (size_t i = 0, j; i < n; i = j){
+        Entry owner = lookup(h, mem[i]);
+        for (j = i + 1; j < n && owner && !(owner & 1) && lookup(h, mem[j]) == owner; j++)
+            ;
+        if (owner == 0 || (owner & 1)){
+            heapfree(h, mem[i]);
+            continue;
+        }
+        bfree_bulk(((Arena *)owner)->pool, mem + i, j - i);
+        opened(h, (Arena *)owner);
+    }
+}
+
+/*  (1) find owner of mem in page map
+    (2) resize an arena block w/brealloc, which grows or shrinks it in place when it can,
+        and keep a large region whose pages already hold size
+    (3) otherwise allocate anywhere in the heap, copy what fits, and free the old memory
+    (4) return pointer to memory, or NULL w/mem untouched on failure, or if the heap doesn't own mem
+*/
+extern void *heaprealloc(Heap heap, void *mem, size_t size){
+    HeapT *h = heap;
+
+    Entry owner = lookup(h, mem);
+    if (owner == 0 || size == 0)
+        return NULL;
+
+    size_t old;
+    if (owner & 1){
+        old = (owner >> 1) << PAGESHIFT;
+        if (size <= old && size > e2size(h->u))
+            return mem;
+    } else {
+        Arena *a = (Arena *)owner;
+        old = bsize(a->pool, mem);
+        if (size <= e2size(h->u)){
+            void *new = brealloc(a->pool, mem, size);
+            if (new){
+                opened(h, a);       //a shrunk or moved block leaves room behind
+                return new;
+            }
+        }
+    }
+
+    void *new = heapalloc(h, size);
+    if (new == NULL)
+        return NULL;
+    memcpy(new, mem, old < size ? old : size);
+    heapfree(h, mem);
+    return new;
+}
+
+/*  (1) find owner of mem in page map
+    (2) return size of its block or large region, or 0 if the heap doesn't own it
+*/
+extern size_t heapsize(Heap heap, void *mem){
+    HeapT *h = heap;
+
+    Entry owner = lookup(h, mem);
+    if (owner == 0)
+        return 0;
+    if (owner & 1)
+        return (owner >> 1) << PAGESHIFT;
+    return bsize(((Arena *)owner)->pool, mem);
+}
+
+/*  (1) take each arena's stats, and add them up
+        each arena's peak is its own, so their sum is a bound on the heap's
+    (2) return nothing; large regions are the heap's own mappings, and aren't counted
+*/
+extern void heapstats(Heap heap, BallocStats *stats){
+    HeapT *h = heap;
+
+    *stats = (BallocStats){0};
+    stats->l = h->l;
+    stats->u = h->u;
+    int n = __atomic_load_n(&h->narenas, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < n; i++){
+        BallocStats s;
+        bstats(arena(h, i)->pool, &s);
+        stats->requested += s.requested;
+        stats->granted += s.granted;
+        stats->live += s.live;
+        stats->peak += s.peak;
+        stats->failed += s.failed;
+        stats->untouched += s.untouched;
+        stats->dirty += s.dirty;
+        for (int e = s.l; e <= s.u; e++){
+            stats->levels[e].free += s.levels[e].free;
+            stats->levels[e].allocated += s.levels[e].allocated;
+            stats->levels[e].peak += s.levels[e].peak;
+            stats->levels[e].requested += s.levels[e].requested;
+            stats->levels[e].granted += s.levels[e].granted;
+            stats->levels[e].live += s.levels[e].live;
+            stats->levels[e].splits += s.levels[e].splits;
+            stats->levels[e].merges += s.levels[e].merges;
+            stats->levels[e].fails += s.levels[e].fails;
+        }
+    }
+}
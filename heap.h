@@ -0,0 +1,25 @@
+// A growable heap of buddy arenas, for the malloc wrapper.
+
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stdio.h>
+#include "balloc.h"
+
+typedef void *Heap;
+
+extern Heap heapcreate(int l, int u);
+extern void heapdelete(Heap h);
+
+extern void  *heapalloc(Heap h, size_t size);
+extern void  *heapalign(Heap h, size_t size, size_t align);
+extern void  *heapcalloc(Heap h, size_t n, size_t size);
+extern void   heapfree(Heap h, void *mem);
+extern size_t heapalloc_bulk(Heap h, size_t size, size_t n, void **out);
+extern void   heapfree_bulk(Heap h, void **mem, size_t n);
+extern void  *heaprealloc(Heap h, void *mem, size_t size);
+extern size_t heapsize(Heap h, void *mem);
+
+extern void heapstats(Heap h, BallocStats *stats);
+
+#endif
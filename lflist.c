@@ -0,0 +1,194 @@
+/* Author: Zella Running
+ * Description: Lock-free free lists, one Treiber stack per block size, w/a version tag in each head so a block popped and pushed again between another thread's read and its compare-and-swap can't fool it. Links live out of band, one 32-bit block index per block, and a free bit per block decides who owns it: a free and its buddy's merge race on the one word holding both bits, so coalescing needs no lock either.
+ * Class: CS 451 - HW2 Memory Allocator w/Buddy System
+ * Date: 2026 February 11
+ */
+
+#include "lflist.h"
+#include "bm.h"
+#include "utils.h"
+#include <stdint.h>
+#include <stdio.h>
+
+#define INDEX 0xffffffffUL  //low half of a head: index of top block, plus one, 0 when empty
+                            //high half: tag, bumped on every pop
+
+// Level structure: one per block size, its head on a cache line of its own, since every thread hits it
+// a block is on the stack at most once: stacked is set before it is pushed, and cleared after it is popped
+// an entry whose free bit is clear is stale, its block was claimed by a merge, and pop skips it
+typedef struct {
+    uint64_t head;          //tag and top of stack
+    size_t blocks;          //number of whole 2^e blocks in the pool
+    uint32_t *links;        //w/each stacked block, index of the next one down, plus one, 0 at the bottom
+    BM free;                //bit i is set when block i is free at this level
+    BM stacked;             //bit i is set while block i has an entry on the stack
+} __attribute__((aligned(64))) Level;
+
+// Lists structure: one level per block size, then each level's links and bitmaps
+typedef struct {
+    int l, u;               //min exponent and max exponent of block sizes
+    Level levels[];
+} Lists;
+
+//index of block mem at level e
+static size_t indexof(void *base, void *mem, int e){
+    return (size_t)(mem - base) >> e;
+}
+
+//bytes of a lists structure for a pool of size bytes and levels l..u, or 0 if some block index wouldn't fit a link
+extern size_t lflistbytes(size_t size, int l, int u){
+    if ((size >> l) >= INDEX)
+        return 0;
+    size_t at = sizeof(Lists) + (u - l + 1) * sizeof(Level), piece;
+    for (int e = l; e <= u; e++){
+        size_t blocks = size >> e;
+        at = place(at, blocks * sizeof(uint32_t), &piece);
+        at = place(at, bmbytes(blocks), &piece);
+        at = place(at, bmbytes(blocks), &piece);
+    }
+    return at;
+}
+
+/*  (1) lay out lists structure in mem, which holds lflistbytes(size, l, u) and must be zero
+    (2) give each level its links and bitmaps, all empty
+    (3) return pointer to lists
+*/
+extern LFList lflistinit(void *mem, size_t size, int l, int u){
+    Lists *lists = mem;
+    lists->l = l;
+    lists->u = u;
+
+    size_t at = sizeof(Lists) + (u - l + 1) * sizeof(Level), piece;
+    for (int e = l; e <= u; e++){
+        Level *level = &lists->levels[e - l];
+        level->head = 0;
+        level->blocks = size >> e;
+        at = place(at, level->blocks * sizeof(uint32_t), &piece);
+        level->links = mem + piece;
+        at = place(at, bmbytes(level->blocks), &piece);
+        level->free = bminit(mem + piece, level->blocks);
+        at = place(at, bmbytes(level->blocks), &piece);
+        level->stacked = bminit(mem + piece, level->blocks);
+    }
+    return lists;
+}
+
+//push block i onto level's stack, which it must not be on
+static void push(Level *level, size_t i){
+    uint64_t head = __atomic_load_n(&level->head, __ATOMIC_RELAXED);
+    do {
+        __atomic_store_n(&level->links[i], (uint32_t)(head & INDEX), __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&level->head, &head, (head & ~INDEX) | (i + 1), 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*  (1) read the head, and the link of the block on top, which may be stale by the time it's used
+    (2) swing the head to that link, bumping the tag, so the swap fails if the block was popped and pushed back meanwhile
+    (3) return the block's index, or -1 if the stack is empty
+*/
+static long pop(Level *level){
+    uint64_t head = __atomic_load_n(&level->head, __ATOMIC_ACQUIRE);
+    for (;;){
+        size_t top = head & INDEX;
+        if (top == 0)
+            return -1;
+        uint64_t next = __atomic_load_n(&level->links[top - 1], __ATOMIC_RELAXED);
+        uint64_t tag = (head & ~INDEX) + (INDEX + 1);
+        if (__atomic_compare_exchange_n(&level->head, &head, tag | next, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return top - 1;
+    }
+}
+
+/*  (1) pop entries off level e's stack until one's block is still free
+    (2) clear its stacked bit, so a free of it from now on pushes it again, then its free bit, which makes it ours
+        the other order could lose a block: freed between the two, it would be left free but never pushed
+    (3) return pointer to block, or NULL if the stack is empty
+*/
+extern void *lflistalloc(LFList f, void *base, int e){
+    Lists *lists = f;
+    Level *level = &lists->levels[e - lists->l];
+    for (;;){
+        long i = pop(level);
+        if (i < 0)
+            return NULL;
+        bmtac(level->stacked, i);
+        if (bmtac(level->free, i))
+            return base + ((size_t)i << e);
+    }
+}
+
+/*  (1) in one atomic step on the word holding both buddies' free bits, claim the buddy if it is free,
+        or else mark mem free; there is no buddy at level u, or past the last whole block
+    (2) once free, push mem, unless an entry for it is still on the stack, waiting to be popped
+    (3) return 1 if the buddy was claimed, and mem was not freed, or 0
+*/
+extern int lflistfree(LFList f, void *base, void *mem, int e){
+    Lists *lists = f;
+    Level *level = &lists->levels[e - lists->l];
+    size_t i = indexof(base, mem, e);
+
+    if (e < lists->u && (i ^ 1) < level->blocks){
+        if (bmtakeorset(level->free, i ^ 1, i))
+            return 1;
+    } else {
+        bmtas(level->free, i);
+    }
+    if (!bmtas(level->stacked, i))
+        push(level, i);
+    return 0;
+}
+
+/*  (1) clear the free bit of block mem at level e, taking it out from under its stack entry
+    (2) return 1 if it was free, and is now the caller's, or 0
+*/
+extern int lflistclaim(LFList f, void *base, void *mem, int e){
+    Lists *lists = f;
+    Level *level = &lists->levels[e - lists->l];
+    size_t i = indexof(base, mem, e);
+    return i < level->blocks && bmtac(level->free, i);
+}
+
+/*  (1) return first block free at level e, or NULL if none
+    (2) other threads may free and take blocks during the walk, so it sees each block's bit at some moment during it
+*/
+extern void *lflistfirst(LFList f, void *base, int e){
+    Lists *lists = f;
+    Level *level = &lists->levels[e - lists->l];
+    size_t i = bmffs(level->free, 0, level->blocks);
+    return i < level->blocks ? base + (i << e) : NULL;
+}
+
+/*  (1) return next block free at level e after mem, or NULL at the end
+*/
+extern void *lflistnext(LFList f, void *base, void *mem, int e){
+    Lists *lists = f;
+    Level *level = &lists->levels[e - lists->l];
+    size_t i = bmffs(level->free, indexof(base, mem, e) + 1, level->blocks);
+    return i < level->blocks ? base + (i << e) : NULL;
+}
+
+//number of blocks free at level e
+extern size_t lflistcount(LFList f, int e){
+    Lists *lists = f;
+    Level *level = &lists->levels[e - lists->l];
+    return bmcount(level->free, 0, level->blocks);
+}
+
+/*  (1) print free blocks at each level from l to u, in address order, not stack order
+    (2) return nothing
+*/
+extern void lflistprint(LFList f, void *base){
+    Lists *lists = f;
+
+    for (int e = lists->l; e <= lists->u; e++){
+        printf("Free list[2^%d] (size %4lu): ", e, e2size(e));
+        void *mem = lflistfirst(f, base, e);
+        if (mem == NULL){
+            printf("empty\n");
+            continue;
+        }
+        for (; mem != NULL; mem = lflistnext(f, base, mem, e))
+            printf("%p -> ", mem);
+        printf("NULL\n");
+    }
+}
@@ -0,0 +1,25 @@
+// Lock-free free lists, one per block size, for pools w/BALLOC_LOCKFREE.
+
+#ifndef LFLIST_H
+#define LFLIST_H
+
+#include <stdio.h>
+
+typedef void *LFList;
+
+extern size_t lflistbytes(size_t size, int l, int u);
+extern LFList lflistinit(void *mem, size_t size, int l, int u);
+
+// lflistfree returns 1 if it claimed mem's free buddy instead, for the
+// caller to merge w/mem, and 0 once mem is free on level e.
+extern void *lflistalloc(LFList f, void *base, int e);
+extern int   lflistfree(LFList f, void *base, void *mem, int e);
+extern int   lflistclaim(LFList f, void *base, void *mem, int e);
+
+extern void  *lflistfirst(LFList f, void *base, int e);
+extern void  *lflistnext(LFList f, void *base, void *mem, int e);
+extern size_t lflistcount(LFList f, int e);
+
+extern void lflistprint(LFList f, void *base);
+
+#endif
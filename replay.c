@@ -0,0 +1,237 @@
+/* Author: Zella Running
+ * Description: Replays an allocation trace recorded by the malloc wrapper against one buddy pool, at full speed and in recorded order, and reports throughput, fragmentation over time and peak footprint.
+ * Class: CS 451 - HW2 Memory Allocator w/Buddy System
+ * Date: 2026 February 11
+ */
+#include "balloc.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ROWS 20                 //fragmentation is sampled this many times over the trace
+
+// Op structure: one call, w/the block it names turned into a dense ID
+typedef struct {
+    uint32_t op;
+    uint32_t id;
+    uint64_t size;
+} Op;
+
+// Table structure: recorded address -> ID of the block living there, open addressing w/linear probing
+typedef struct {
+    uint64_t *keys;             //0: empty, 1: deleted
+    uint32_t *ids;
+    size_t mask;
+} Table;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static size_t slot(Table *t, uint64_t key) {
+    return (key >> 4) * 0x9e3779b97f4a7c15ull >> 20 & t->mask;
+}
+
+//ID of the block living at key, or -1 if none, w/its slot in *at
+static long find(Table *t, uint64_t key, size_t *at) {
+    for (size_t i = slot(t, key); t->keys[i]; i = (i + 1) & t->mask) {
+        if (t->keys[i] == key) {
+            *at = i;
+            return t->ids[i];
+        }
+    }
+    return -1;
+}
+
+//record that the block w/ID id lives at key; deleted slots are never reused, the table is sized for every insert
+static void insert(Table *t, uint64_t key, uint32_t id) {
+    size_t i = slot(t, key);
+    while (t->keys[i])
+        i = (i + 1) & t->mask;
+    t->keys[i] = key;
+    t->ids[i] = id;
+}
+
+/*  (1) turn each record into an op, giving each block an ID when malloc or calloc hands it out
+    (2) a realloc's first record takes its block's address out of the table, since other threads
+        may be handed that address before the second record, and the second puts the ID back in
+        at the new address, which is where the op goes
+    (3) drop records for addresses the trace never saw handed out, and failed calls
+    (4) return number of ops, w/number of IDs in *ids and records dropped in *dropped
+*/
+static size_t prepare(TraceRecord *rec, size_t n, Op *ops, size_t *ids, size_t *dropped) {
+    Table t;
+    size_t cap = 2;
+    while (cap < 2 * n)
+        cap *= 2;
+    t.keys = calloc(cap, sizeof(uint64_t));
+    t.ids = malloc(cap * sizeof(uint32_t));
+    t.mask = cap - 1;
+    long *held = malloc((n ? n : 1) * sizeof(long));   //w/each realloc's first record, ID of its block
+
+    size_t m = 0, at;
+    *ids = 0;
+    *dropped = 0;
+    for (size_t i = 0; i < n; i++) {
+        long id;
+        switch (rec[i].op) {
+        case TRACE_MALLOC:
+        case TRACE_CALLOC:
+            if (rec[i].ptr == 0)
+                break;
+            if (find(&t, rec[i].ptr, &at) >= 0)
+                t.keys[at] = 1;     //never freed in the trace, the old block stays live in the replay
+            insert(&t, rec[i].ptr, *ids);
+            ops[m++] = (Op){rec[i].op, (*ids)++, rec[i].size};
+            continue;
+        case TRACE_FREE:
+            if ((id = find(&t, rec[i].ptr, &at)) < 0)
+                break;
+            t.keys[at] = 1;
+            ops[m++] = (Op){TRACE_FREE, id, 0};
+            continue;
+        case TRACE_REALLOC:
+            if ((held[i] = find(&t, rec[i].ptr, &at)) < 0)
+                break;
+            t.keys[at] = 1;
+            continue;
+        case TRACE_RESIZED:
+            if (rec[i].ref >= i || rec[rec[i].ref].op != TRACE_REALLOC || (id = held[rec[i].ref]) < 0)
+                break;
+            if (rec[i].ptr == 0) {
+                insert(&t, rec[rec[i].ref].ptr, id);    //failed, block stays where it was
+                break;
+            }
+            insert(&t, rec[i].ptr, id);
+            ops[m++] = (Op){TRACE_REALLOC, id, rec[i].size};
+            continue;
+        }
+        (*dropped)++;
+    }
+    free(t.keys);
+    free(t.ids);
+    free(held);
+    return m;
+}
+
+/*  (1) map the trace, and turn its records into ops on dense IDs, outside the timed replay
+    (2) create a lazy pool, 2^32 bytes unless the command line says otherwise
+    (3) run the ops through balloc, bcalloc, brealloc and bfree, tracking bytes requested and,
+        w/bsize, bytes granted; the clock stops while fragmentation is sampled
+    (4) print fragmentation ROWS times over the trace, then throughput and peaks
+        peak footprint is the most seen at a sample, so it can miss a spike between two
+*/
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s trace [pool exponent] [min block exponent] [tree|slab|defer]...\n", argv[0]);
+        return 1;
+    }
+    int u = argc > 2 ? atoi(argv[2]) : 32;
+    int l = argc > 3 ? atoi(argv[3]) : 4;
+    int flags = BALLOC_LAZY;
+    for (int i = 4; i < argc; i++) {
+        if (!strcmp(argv[i], "tree"))
+            flags |= BALLOC_TREE;
+        else if (!strcmp(argv[i], "slab"))
+            flags |= BALLOC_SLAB;
+        else if (!strcmp(argv[i], "defer"))
+            flags |= BALLOC_DEFER;
+    }
+
+    Trace trace = traceopen(argv[1]);
+    if (!trace) {
+        fprintf(stderr, "%s: not a trace\n", argv[1]);
+        return 1;
+    }
+    size_t n, ids, dropped;
+    TraceRecord *rec = tracerecords(trace, &n);
+    Op *ops = malloc((n ? n : 1) * sizeof(Op));
+    size_t m = prepare(rec, n, ops, &ids, &dropped);
+    double span = n ? rec[n - 1].ns / 1e9 : 0;
+    traceclose(trace);
+
+    Balloc pool = bcreatef((size_t)1 << u, l, u, flags);
+    if (!pool) {
+        fprintf(stderr, "could not create a 2^%d pool\n", u);
+        return 1;
+    }
+    void **blocks = calloc(ids ? ids : 1, sizeof(void *));
+    size_t *sizes = calloc(ids ? ids : 1, sizeof(size_t));
+
+    printf("Trace: %zu records over %.2f s, %zu ops on %zu blocks, %zu dropped\n", n, span, m, ids, dropped);
+    printf("Pool: 2^%d bytes, blocks 2^%d to 2^%d\n\n", u, l, u);
+    printf("%12s %14s %14s %10s %10s %14s\n", "ops", "requested KiB", "granted KiB", "internal %", "external %", "footprint KiB");
+
+    size_t requested = 0, granted = 0, peak = 0, fails = 0, footprint = 0;
+    double elapsed = 0;
+    BallocStats s;
+    for (size_t row = 1, i = 0; row <= ROWS; row++) {
+        size_t end = m * row / ROWS;
+        double start = now();
+        for (; i < end; i++) {
+            Op *op = &ops[i];
+            void *mem = blocks[op->id];
+            switch (op->op) {
+            case TRACE_MALLOC:
+            case TRACE_CALLOC:
+                mem = op->op == TRACE_MALLOC ? balloc(pool, op->size) : bcalloc(pool, 1, op->size);
+                if (!mem) {
+                    fails++;
+                    break;
+                }
+                blocks[op->id] = mem;
+                sizes[op->id] = op->size;
+                requested += op->size;
+                granted += bsize(pool, mem);
+                break;
+            case TRACE_FREE:
+                if (!mem)
+                    break;
+                requested -= sizes[op->id];
+                granted -= bsize(pool, mem);
+                bfree(pool, mem);
+                blocks[op->id] = NULL;
+                break;
+            case TRACE_REALLOC:
+                if (!mem)
+                    break;
+                granted -= bsize(pool, mem);
+                mem = brealloc(pool, mem, op->size);
+                if (mem) {
+                    blocks[op->id] = mem;
+                    requested += op->size - sizes[op->id];
+                    sizes[op->id] = op->size;
+                } else {
+                    fails++;
+                }
+                granted += bsize(pool, blocks[op->id]);
+                break;
+            }
+            if (granted > peak)
+                peak = granted;
+        }
+        elapsed += now() - start;
+
+        //footprint: bytes on pages the replay has written and no purge has released
+        //external fragmentation: share of the footprint held by free blocks, not granted ones
+        bstats(pool, &s);
+        if (s.dirty > footprint)
+            footprint = s.dirty;
+        printf("%12zu %14zu %14zu %10.1f %10.1f %14zu\n", end, requested / 1024, granted / 1024,
+               granted ? 100.0 * (granted - requested) / granted : 0.0,
+               s.dirty > granted ? 100.0 * (s.dirty - granted) / s.dirty : 0.0, s.dirty / 1024);
+    }
+
+    printf("\nThroughput: %.2f Mops/s (%.1f ns/op)\n", m / elapsed * 1e3, m ? elapsed / m : 0.0);
+    printf("Peak granted: %zu KiB, peak footprint: %zu KiB, failed calls: %zu\n", peak / 1024, footprint / 1024, fails);
+
+    free(blocks);
+    free(sizes);
+    free(ops);
+    bdelete(pool);
+    return 0;
+}
@@ -0,0 +1,238 @@
+/* Author: Zella Running
+ * Description: Carves 2^e buddy blocks into dense arrays of small objects, one size class per slab. Each slab keeps a header w/a free bitmap at its start, and slabs w/room are kept on a list per class. List links are offsets from the pool's base, like free-list links, so lists read the same wherever the pool is mapped.
+ * Class: CS 451 - HW2 Memory Allocator w/Buddy System
+ * Date: 2026 February 11
+ */
+
+#include "slab.h"
+#include "utils.h"
+#include <stdio.h>
+
+#define WORDBITS (sizeof(unsigned long) * bitsperbyte)
+
+// object sizes, multiples of 8, w/steps between powers of two so few bytes are wasted rounding up
+static const size_t sizes[SLABCLASSES] = {
+    8, 16, 24, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512
+};
+
+// Link: offset of a slab from base, plus one, so 0 still ends a list
+typedef size_t Link;
+
+// Slab structure: overlays the first bytes of every slab, objects follow the bitmap
+typedef struct {
+    Link next;              //next slab of same class w/a free object
+    Link prev;              //previous one, 0 for first
+    int class;              //size class of every object in slab
+    int nfree;              //free objects
+    unsigned long free[];   //bit i is set when object i is free
+} Slab;
+
+// Class structure: layout of a slab of this class, and its list of slabs w/room, padded to its own cache line
+typedef struct {
+    size_t size;            //object size
+    size_t first;           //offset of object 0 from start of slab
+    int count;              //objects per slab, 0 if not even two fit
+    Link partial;           //slabs w/at least one free object
+} __attribute__((aligned(64))) Class;
+
+// Slabs structure: one class per object size, plus a lookup from size to class
+typedef struct {
+    int e;                                  //slabs are 2^e bytes
+    unsigned char lookup[SLABMAX / 8 + 1];  //class for sizes (8i-7)..8i, 0xff if none fits
+    Class classes[SLABCLASSES];
+} SlabsT;
+
+//words of free bitmap for count objects
+static size_t words(int count){
+    return divup(count, WORDBITS);
+}
+
+//slab a link points to, or NULL for 0
+static Slab *slabat(void *base, Link link){
+    return link ? base + link - 1 : NULL;
+}
+
+//link to slab, or 0 for NULL
+static Link linkto(void *base, Slab *slab){
+    return slab ? (size_t)((void *)slab - base) + 1 : 0;
+}
+
+//bytes of a slabs structure
+extern size_t slabsbytes(void){
+    return sizeof(SlabsT);
+}
+
+/*  (1) lay out slabs structure in mem, which holds slabsbytes()
+    (2) for each class, find the most objects that fit in 2^e bytes after the header and its bitmap
+        objects are aligned to 16 bytes if their size is a multiple of 16, and to 8 otherwise
+    (3) fill size lookup w/the smallest class holding each size, skipping classes w/fewer than two objects
+    (4) return pointer to slabs
+*/
+extern Slabs slabsinit(void *mem, int e){
+    SlabsT *s = mem;
+    s->e = e;
+
+    size_t slabsize = e2size(e);
+    for (int c = 0; c < SLABCLASSES; c++){
+        Class *class = &s->classes[c];
+        size_t align = sizes[c] % 16 ? 8 : 16;
+        class->size = sizes[c];
+        class->partial = 0;
+        class->count = 0;
+        for (size_t n = slabsize / sizes[c]; n >= 2; n--){
+            size_t first = divup(sizeof(Slab) + words(n) * sizeof(unsigned long), align) * align;
+            if (first + n * sizes[c] <= slabsize){
+                class->count = n;
+                class->first = first;
+                break;
+            }
+        }
+    }
+
+    for (size_t i = 0; i <= SLABMAX / 8; i++){
+        s->lookup[i] = 0xff;
+        for (int c = 0; c < SLABCLASSES; c++){
+            if (s->classes[c].count && sizes[c] >= i * 8){
+                s->lookup[i] = c;
+                break;
+            }
+        }
+    }
+    return s;
+}
+
+//class that holds size, or -1 if size is too big for a slab
+extern int slabclass(Slabs slabs, size_t size){
+    SlabsT *s = slabs;
+    if (size == 0 || size > SLABMAX)
+        return -1;
+    int c = s->lookup[divup(size, 8)];
+    return c == 0xff ? -1 : c;
+}
+
+//class of a slab, fixed while the slab is live
+extern int slabclassof(void *slab){
+    return ((Slab *)slab)->class;
+}
+
+//object size of class c
+extern size_t slabobjsize(Slabs slabs, int c){
+    SlabsT *s = slabs;
+    return s->classes[c].size;
+}
+
+//put slab on the front of its class's list
+static void listadd(void *base, Class *class, Slab *slab){
+    slab->prev = 0;
+    slab->next = class->partial;
+    if (class->partial)
+        slabat(base, class->partial)->prev = linkto(base, slab);
+    class->partial = linkto(base, slab);
+}
+
+//take slab off its class's list
+static void listremove(void *base, Class *class, Slab *slab){
+    if (slab->prev)
+        slabat(base, slab->prev)->next = slab->next;
+    else
+        class->partial = slab->next;
+    if (slab->next)
+        slabat(base, slab->next)->prev = slab->prev;
+}
+
+/*  (1) take the first slab w/room in class c
+    (2) find its first free object w/one count-trailing-zeros per bitmap word, and mark it allocated
+    (3) drop the slab from the list once it is full
+    (4) return pointer to object, or NULL if class c has no slab w/room
+    caller holds class c's lock
+*/
+extern void *slaballoc(Slabs slabs, void *base, int c){
+    SlabsT *s = slabs;
+    Class *class = &s->classes[c];
+    Slab *slab = slabat(base, class->partial);
+    if (!slab)
+        return NULL;
+
+    size_t w = 0;
+    while (slab->free[w] == 0)
+        w++;
+    size_t i = w * WORDBITS + __builtin_ctzl(slab->free[w]);
+    slab->free[w] &= slab->free[w] - 1;
+
+    if (--slab->nfree == 0)
+        listremove(base, class, slab);
+    return (void *)slab + class->first + i * class->size;
+}
+
+/*  (1) lay out a fresh 2^e block as an empty slab of class c: every object free
+    (2) put it on class c's list
+    caller holds class c's lock
+*/
+extern void slabinit(Slabs slabs, void *base, void *mem, int c){
+    SlabsT *s = slabs;
+    Class *class = &s->classes[c];
+    Slab *slab = mem;
+
+    slab->class = c;
+    slab->nfree = class->count;
+    for (size_t w = 0; w < words(class->count); w++){
+        size_t left = class->count - w * WORDBITS;
+        slab->free[w] = left >= WORDBITS ? ~0UL : (1UL << left) - 1;
+    }
+    listadd(base, class, slab);
+}
+
+//index of the object mem points at, or -1 if it isn't the start of an object in slab
+static long object(SlabsT *s, Slab *slab, void *mem){
+    Class *class = &s->classes[slab->class];
+    size_t offset = mem - (void *)slab;
+    if (offset < class->first || (offset - class->first) % class->size)
+        return -1;
+    size_t i = (offset - class->first) / class->size;
+    return i < (size_t)class->count ? (long)i : -1;
+}
+
+/*  (1) find object's index from its offset in slab, and mark it free
+    (2) put slab back on its class's list if it was full
+    (3) if slab is now empty, take it off the list
+    (4) return 1 if the caller should give the empty slab back to the pool, 0 if not,
+        or -1 if mem is not an allocated object
+    caller holds the slab's class lock
+*/
+extern int slabfree(Slabs slabs, void *base, void *mem_slab, void *mem){
+    SlabsT *s = slabs;
+    Slab *slab = mem_slab;
+    Class *class = &s->classes[slab->class];
+
+    long i = object(s, slab, mem);
+    if (i < 0 || (slab->free[i / WORDBITS] >> (i % WORDBITS)) & 1)
+        return -1;
+    slab->free[i / WORDBITS] |= 1UL << (i % WORDBITS);
+
+    if (slab->nfree++ == 0)
+        listadd(base, class, slab);
+    if (slab->nfree == class->count){
+        listremove(base, class, slab);
+        return 1;
+    }
+    return 0;
+}
+
+//size of the object mem points at, or 0 if it isn't an allocated object
+extern size_t slabsize(Slabs slabs, void *mem_slab, void *mem){
+    SlabsT *s = slabs;
+    Slab *slab = mem_slab;
+    long i = object(s, slab, mem);
+    if (i < 0)
+        return 0;
+    unsigned long word = __atomic_load_n(&slab->free[i / WORDBITS], __ATOMIC_RELAXED);
+    return (word >> (i % WORDBITS)) & 1 ? 0 : s->classes[slab->class].size;
+}
+
+//print slab's class and how full it is
+extern void slabprint(Slabs slabs, void *mem_slab){
+    SlabsT *s = slabs;
+    Slab *slab = mem_slab;
+    Class *class = &s->classes[slab->class];
+    printf("slab of %lu-byte objects, %d of %d free", class->size, slab->nfree, class->count);
+}
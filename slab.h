@@ -0,0 +1,27 @@
+// Slabs of small objects, carved from buddy blocks.
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdio.h>
+
+#define SLABCLASSES 18          // number of size classes
+#define SLABMAX     512         // largest object a slab holds
+
+typedef void *Slabs;
+
+extern size_t slabsbytes(void);
+extern Slabs  slabsinit(void *mem, int e);
+
+extern int    slabclass(Slabs s, size_t size);
+extern int    slabclassof(void *slab);
+extern size_t slabobjsize(Slabs s, int c);
+
+extern void  *slaballoc(Slabs s, void *base, int c);
+extern void   slabinit(Slabs s, void *base, void *slab, int c);
+extern int    slabfree(Slabs s, void *base, void *slab, void *mem);
+extern size_t slabsize(Slabs s, void *slab, void *mem);
+
+extern void slabprint(Slabs s, void *slab);
+
+#endif
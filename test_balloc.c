@@ -9,7 +9,14 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
 #include "balloc.h"
+#include "bm.h"
+#include "heap.h"
 
 void test_basic_allocation() {
     printf("=== Test 1: Basic Allocation ===\n");
@@ -26,15 +33,15 @@ void test_basic_allocation() {
     //allocate a few blocks
     void *p1 = balloc(pool, 100);  //should get 128 bytes (2^7)
     printf("\nAllocated 100 bytes at %p\n", p1);
-    printf("Block size: %u\n", bsize(pool, p1));
+    printf("Block size: %zu\n", bsize(pool, p1));
     
     void *p2 = balloc(pool, 200);  //should get 256 bytes (2^8)
     printf("\nAllocated 200 bytes at %p\n", p2);
-    printf("Block size: %u\n", bsize(pool, p2));
+    printf("Block size: %zu\n", bsize(pool, p2));
     
     void *p3 = balloc(pool, 50);   //should get 64 bytes (2^6)
     printf("\nAllocated 50 bytes at %p\n", p3);
-    printf("Block size: %u\n", bsize(pool, p3));
+    printf("Block size: %zu\n", bsize(pool, p3));
     
     printf("\nAfter allocations:\n");
     bprint(pool);
@@ -93,8 +100,8 @@ void test_sizes() {
     Balloc pool = bcreate(4096, 4, 12);
     
     struct {
-        unsigned int request;
-        unsigned int expected;
+        size_t request;
+        size_t expected;
     } tests[] = {
         {1, 16},
         {16, 16},
@@ -112,9 +119,9 @@ void test_sizes() {
     
     for (int i = 0; i < num_tests; i++) {
         void *p = balloc(pool, tests[i].request);
-        unsigned int actual = bsize(pool, p);
+        size_t actual = bsize(pool, p);
         
-        printf("Request %4u bytes -> allocated %4u bytes (expected %4u) %s\n",
+        printf("Request %4zu bytes -> allocated %4zu bytes (expected %4zu) %s\n",
                tests[i].request, actual, tests[i].expected,
                actual == tests[i].expected ? "OK" : "FAIL");
         
@@ -226,6 +233,1788 @@ void test_write_read() {
     printf("\nTest 6: PASSED\n\n");
 }
 
+void test_size_lookup() {
+    printf("=== Test 7: Block Size Lookup ===\n");
+    
+    Balloc pool = bcreate(4096, 4, 12);
+    int ok = 1;
+    
+    //two buddies allocated together must keep separate sizes
+    char *p1 = balloc(pool, 64);
+    char *p2 = balloc(pool, 64);
+    bfree(pool, p1);
+    if (bsize(pool, p2) != 64) {
+        printf("FAIL: buddy lost its size after neighbour was freed\n");
+        ok = 0;
+    }
+    
+    //interior pointers and freed blocks have no size
+    char *p3 = balloc(pool, 1000);
+    if (bsize(pool, p3 + 16) != 0 || bsize(pool, p3 + 1) != 0) {
+        printf("FAIL: interior pointer reported a size\n");
+        ok = 0;
+    }
+    bfree(pool, p3);
+    if (bsize(pool, p3) != 0) {
+        printf("FAIL: freed block still reports a size\n");
+        ok = 0;
+    }
+    
+    //double free is reported and ignored
+    printf("Expect one error for double free:\n");
+    bfree(pool, p3);
+    
+    bfree(pool, p2);
+    
+    //whole pool coalesced back into one block
+    void *all = balloc(pool, 4096);
+    if (all == NULL) {
+        printf("FAIL: pool did not coalesce back to one block\n");
+        ok = 0;
+    }
+    bfree(pool, all);
+    
+    bdelete(pool);
+    printf("\nTest 7: %s\n\n", ok ? "PASSED" : "FAILED");
+}
+
+#define STRESS_THREADS 4
+#define STRESS_ROUNDS 200000
+#define STRESS_LIVE 64
+
+static Balloc stress_pool;
+static int stress_errors;
+
+//each thread churns its own blocks, stamping them with its id and checking the stamp before freeing
+static void *stress_thread(void *arg) {
+    int id = (int)(long)arg;
+    unsigned int seed = id + 1;
+    unsigned char *live[STRESS_LIVE] = {0};
+    unsigned int sizes[STRESS_LIVE] = {0};
+    
+    for (int i = 0; i < STRESS_ROUNDS; i++) {
+        int slot = rand_r(&seed) % STRESS_LIVE;
+        if (live[slot]) {
+            for (unsigned int j = 0; j < sizes[slot]; j++) {
+                if (live[slot][j] != id) {
+                    __atomic_fetch_add(&stress_errors, 1, __ATOMIC_RELAXED);
+                    break;
+                }
+            }
+            bfree(stress_pool, live[slot]);
+            live[slot] = NULL;
+        } else {
+            sizes[slot] = 16 << (rand_r(&seed) % 7);
+            live[slot] = balloc(stress_pool, sizes[slot]);
+            if (live[slot])
+                memset(live[slot], id, sizes[slot]);
+        }
+    }
+    
+    for (int slot = 0; slot < STRESS_LIVE; slot++)
+        bfree(stress_pool, live[slot]);
+    return NULL;
+}
+
+void test_thread_stress() {
+    printf("=== Test 8: Thread-Safe Stress ===\n");
+    
+    stress_pool = bcreatef(1 << 20, 4, 20, BALLOC_THREADSAFE);
+    stress_errors = 0;
+    
+    pthread_t threads[STRESS_THREADS];
+    for (long i = 0; i < STRESS_THREADS; i++)
+        pthread_create(&threads[i], NULL, stress_thread, (void *)(i + 1));
+    for (int i = 0; i < STRESS_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    
+    printf("%d threads x %d operations, %d corrupted blocks\n",
+           STRESS_THREADS, STRESS_ROUNDS, stress_errors);
+    
+    //everything was freed, so the pool must coalesce back into one block
+    void *all = balloc(stress_pool, 1 << 20);
+    if (all == NULL)
+        printf("FAIL: pool did not coalesce back to one block\n");
+    bfree(stress_pool, all);
+    
+    bdelete(stress_pool);
+    printf("\nTest 8: %s\n\n", stress_errors == 0 && all ? "PASSED" : "FAILED");
+}
+
+void test_large_pools() {
+    printf("=== Test 9: Very Large Pools ===\n");
+    int ok = 1;
+    
+    //64 GiB pool, only the pages we touch get committed
+    const int u = 36;
+    Balloc pool = bcreate((size_t)1 << u, 12, u);
+    if (!pool) {
+        printf("SKIP: could not reserve 2^%d bytes\n", u);
+        printf("\nTest 9: PASSED\n\n");
+        return;
+    }
+    
+    //orders 31 and up used to overflow 32-bit sizes and masks
+    struct {
+        size_t request;
+        size_t expected;
+    } tests[] = {
+        {(size_t)1 << 31, (size_t)1 << 31},
+        {((size_t)1 << 32) + 1, (size_t)1 << 33},
+        {(size_t)1 << 34, (size_t)1 << 34},
+    };
+    
+    char *blocks[3];
+    for (int i = 0; i < 3; i++) {
+        blocks[i] = balloc(pool, tests[i].request);
+        size_t actual = bsize(pool, blocks[i]);
+        printf("Request %11zu bytes -> allocated %11zu bytes (expected %11zu) %s\n",
+               tests[i].request, actual, tests[i].expected,
+               actual == tests[i].expected ? "OK" : "FAIL");
+        if (actual != tests[i].expected) {
+            ok = 0;
+            continue;
+        }
+        //touch both ends of the block
+        blocks[i][0] = 'a';
+        blocks[i][actual - 1] = 'z';
+    }
+    
+    //blocks must not overlap, and must lie above 4 GiB offsets where they should
+    for (int i = 0; i < 3; i++) {
+        if (blocks[i] && (blocks[i][0] != 'a' || blocks[i][bsize(pool, blocks[i]) - 1] != 'z')) {
+            printf("FAIL: block %d was overwritten\n", i);
+            ok = 0;
+        }
+    }
+    
+    for (int i = 0; i < 3; i++)
+        bfree(pool, blocks[i]);
+    
+    //whole pool coalesces back into one 2^36 block
+    void *all = balloc(pool, (size_t)1 << u);
+    if (bsize(pool, all) != (size_t)1 << u) {
+        printf("FAIL: pool did not coalesce back to one block\n");
+        ok = 0;
+    }
+    bfree(pool, all);
+    bdelete(pool);
+    
+    //1 TiB pool w/u = 40 only reserves address space
+    pool = bcreate((size_t)1 << 40, 16, 40);
+    if (pool) {
+        char *p = balloc(pool, ((size_t)1 << 39) + 1);
+        if (bsize(pool, p) != (size_t)1 << 40) {
+            printf("FAIL: 2^40 allocation\n");
+            ok = 0;
+        } else {
+            p[((size_t)1 << 40) - 1] = 1;
+            printf("Allocated and touched a 2^40 byte block\n");
+        }
+        bfree(pool, p);
+        bdelete(pool);
+    } else {
+        printf("SKIP: could not reserve 2^40 bytes\n");
+    }
+    
+    printf("\nTest 9: %s\n\n", ok ? "PASSED" : "FAILED");
+}
+
+void test_lazy_init() {
+    printf("=== Test 10: Lazy Pool Initialization ===\n");
+    int ok = 1;
+    
+    //odd-sized pool, so the lazy pool must carve the 2^12, 2^11 and 2^4 blocks eager init makes
+    const size_t size = 4096 + 2048 + 16;
+    Balloc eager = bcreate(size, 4, 12);
+    Balloc lazy = bcreatef(size, 4, 12, BALLOC_LAZY);
+    
+    printf("Lazy pool before any allocation:\n");
+    bprint(lazy);
+    
+    //both pools run out after the same number of minimum blocks
+    static void *blocks[2][400];
+    int count[2] = {0, 0};
+    Balloc pools[2] = {eager, lazy};
+    for (int i = 0; i < 2; i++) {
+        while (count[i] < 400 && (blocks[i][count[i]] = balloc(pools[i], 16)) != NULL)
+            count[i]++;
+    }
+    printf("\nEager pool held %d blocks, lazy pool held %d blocks\n", count[0], count[1]);
+    if (count[0] != count[1] || count[1] != (int)(size / 16)) {
+        printf("FAIL: expected %zu blocks in each\n", size / 16);
+        ok = 0;
+    }
+    
+    //after freeing everything, the largest blocks are whole again
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < count[i]; j++)
+            bfree(pools[i], blocks[i][j]);
+        void *a = balloc(pools[i], 4096);
+        void *b = balloc(pools[i], 2048);
+        void *c = balloc(pools[i], 16);
+        if (!a || !b || !c || balloc(pools[i], 16)) {
+            printf("FAIL: %s pool did not coalesce back\n", i ? "lazy" : "eager");
+            ok = 0;
+        }
+    }
+    
+    bdelete(eager);
+    bdelete(lazy);
+    printf("\nTest 10: %s\n\n", ok ? "PASSED" : "FAILED");
+}
+
+//1 if bytes [from, to) of p are all zero
+static int zeroed(char *p, size_t from, size_t to) {
+    for (size_t i = from; i < to; i++)
+        if (p[i])
+            return 0;
+    return 1;
+}
+
+void test_trim() {
+    printf("=== Test 11: Trim and Purge ===\n");
+    int ok = 1;
+    
+    Balloc pool = bcreatef(1 << 20, 4, 20, BALLOC_LAZY);
+    
+    //fill a block, free it, and trim: every page after the first goes back to the OS
+    char *p = balloc(pool, 256 * 1024);
+    memset(p, 0xab, 256 * 1024);
+    bfree(pool, p);
+    size_t released = btrim(pool);
+    printf("btrim released %zu bytes\n", released);
+    if (released < 256 * 1024 - 4096) {
+        printf("FAIL: expected at least %d bytes released\n", 256 * 1024 - 4096);
+        ok = 0;
+    }
+    if (btrim(pool) != 0) {
+        printf("FAIL: second btrim released purged pages again\n");
+        ok = 0;
+    }
+    
+    //purged pages read back as zero when reused
+    p = balloc(pool, 256 * 1024);
+    if (!zeroed(p, 4096, 256 * 1024)) {
+        printf("FAIL: purged pages kept stale contents\n");
+        ok = 0;
+    }
+    bfree(pool, p);
+    
+    //immediate policy purges as soon as the block is freed
+    bsetpurge(pool, 16, 0);
+    p = balloc(pool, 128 * 1024);
+    memset(p, 0xcd, 128 * 1024);
+    bfree(pool, p);
+    if (btrim(pool) != 0) {
+        printf("FAIL: immediate policy left dirty pages for btrim\n");
+        ok = 0;
+    }
+    p = balloc(pool, 128 * 1024);
+    if (!zeroed(p, 4096, 128 * 1024)) {
+        printf("FAIL: immediate purge kept stale contents\n");
+        ok = 0;
+    }
+    bfree(pool, p);
+    
+    //blocks smaller than the purge order are left alone
+    p = balloc(pool, 32 * 1024);
+    memset(p, 0xef, 32 * 1024);
+    char *hold = balloc(pool, 32 * 1024);
+    bfree(pool, p);
+    if (btrim(pool) != 0) {
+        printf("FAIL: purged a block below the purge order\n");
+        ok = 0;
+    }
+    bfree(pool, hold);
+    
+    bdelete(pool);
+    printf("\nTest 11: %s\n\n", ok ? "PASSED" : "FAILED");
+}
+
+void test_bulk() {
+    printf("=== Test 12: Bulk Allocation and Free ===\n");
+    int ok = 1;
+    
+    //odd-sized pool: 2^12 + 2^11 + 2^4, so bulk has to draw on more than one level
+    const size_t size = 4096 + 2048 + 16;
+    Balloc pool = bcreatef(size, 4, 12, BALLOC_LAZY);
+    static void *blocks[400];
+    
+    //a batch of 100 comes back as 100 distinct, correctly sized blocks
+    size_t n = balloc_bulk(pool, 64, 100, blocks);
+    printf("balloc_bulk(64, 100) returned %zu blocks\n", n);
+    if (n != 96) {
+        printf("FAIL: expected the 96 64-byte blocks the pool can hold\n");
+        ok = 0;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (bsize(pool, blocks[i]) != 64)
+            ok = 0;
+        for (size_t j = 0; j < i; j++)
+            if (blocks[i] == blocks[j])
+                ok = 0;
+    }
+    if (!ok)
+        printf("FAIL: bulk blocks overlap or have the wrong size\n");
+    
+    //the 16-byte tail is still there
+    void *tail = balloc(pool, 16);
+    if (!tail || balloc(pool, 16)) {
+        printf("FAIL: bulk took more than it handed out\n");
+        ok = 0;
+    }
+    
+    //freeing in scrambled order still coalesces everything back
+    for (size_t i = 0; i < n; i++) {
+        size_t j = (i * 37) % n;
+        void *t = blocks[i]; blocks[i] = blocks[j]; blocks[j] = t;
+    }
+    bfree_bulk(pool, blocks, n);
+    bfree(pool, tail);
+    void *a = balloc(pool, 4096);
+    void *b = balloc(pool, 2048);
+    if (!a || !b) {
+        printf("FAIL: bfree_bulk did not coalesce back\n");
+        ok = 0;
+    }
+    bfree(pool, a);
+    bfree(pool, b);
+    
+    //a batch mixed with scalar blocks, freed partly in bulk
+    n = balloc_bulk(pool, 16, 385, blocks);
+    if (n != 385) {
+        printf("FAIL: expected 385 16-byte blocks, got %zu\n", n);
+        ok = 0;
+    }
+    bfree_bulk(pool, blocks, 200);
+    for (size_t i = 200; i < n; i++)
+        bfree(pool, blocks[i]);
+    if (!balloc(pool, 4096)) {
+        printf("FAIL: mixed bulk and scalar free did not coalesce back\n");
+        ok = 0;
+    }
+    bdelete(pool);
+    
+    //blocks merged by bfree_bulk take their bytes up w/them, so no level goes below zero, and the peak stays put
+    pool = bcreate(1 << 12, 4, 12);
+    void *four[4];
+    for (int round = 0; round < 2; round++) {
+        balloc_bulk(pool, 32, 4, four);
+        bfree_bulk(pool, four, 4);
+    }
+    a = balloc(pool, 100);
+    BallocStats s;
+    bstats(pool, &s);
+    if (s.live != 128 || s.peak != 128 || s.levels[5].live != 0 || s.levels[6].live != 0 || s.levels[7].live != 128) {
+        printf("FAIL: after bulk round trips, %zu live, %zu at 2^7, peak %zu\n", s.live, s.levels[7].live, s.peak);
+        ok = 0;
+    }
+    
+    bdelete(pool);
+    printf("\nTest 12: %s\n\n", ok ? "PASSED" : "FAILED");
+}
+
+void test_bitmap() {
+    printf("=== Test 13: Bitmap Scans and Ranges ===\n");
+    int ok = 1;
+    
+    //odd size, so the last word is partial
+    const size_t bits = 1000;
+    void *mem = calloc(1, bmbytes(bits));
+    BM b = bminit(mem, bits);
+    
+    bmsetrange(b, 60, 140);         //crosses two word boundaries
+    bmset(b, 999);
+    if (bmcount(b, 0, bits) != 141 || bmcount(b, 61, 10) != 10 || bmcount(b, 0, 60) != 0) {
+        printf("FAIL: bmcount\n");
+        ok = 0;
+    }
+    if (bmffs(b, 0, bits) != 60 || bmffs(b, 200, bits) != 999 || bmffs(b, 200, 999) != 999) {
+        printf("FAIL: bmffs\n");
+        ok = 0;
+    }
+    if (bmffc(b, 60, bits) != 200 || bmffc(b, 999, bits) != bits) {
+        printf("FAIL: bmffc\n");
+        ok = 0;
+    }
+    
+    bmclrrange(b, 64, 128);         //exactly two whole words
+    bmflip(b, 100);
+    if (bmcount(b, 0, bits) != 14 || !bmtst(b, 100) || bmtst(b, 64) || !bmtst(b, 63) || !bmtst(b, 192)) {
+        printf("FAIL: bmclrrange/bmflip\n");
+        ok = 0;
+    }
+    
+    //every bit matches a bit-at-a-time scan
+    for (size_t i = 0; i < bits; i++) {
+        size_t expect = i;
+        while (expect < bits && !bmtst(b, expect))
+            expect++;
+        if (bmffs(b, i, bits) != expect)
+            ok = 0;
+    }
+    if (!ok)
+        printf("FAIL: bmffs disagrees with bmtst\n");
+    
+    free(mem);
+    printf("\nTest 13: %s\n\n", ok ? "PASSED" : "FAILED");
+}
+
+/*  a pool w/flags can't have 2^0 blocks, whose order 0 the order map reads as no block
+    at the smallest order it can have, every 2-byte block is sized, freed and coalesced back
+    returns 1 if all went well
+*/
+static int smallest_order(int flags) {
+    if (bcreatef(4096, 0, 12, flags)) {
+        printf("FAIL: pool w/flags 0x%02x created w/2^0 blocks\n", flags);
+        return 0;
+    }
+    Balloc pool = bcreatef(4096, 1, 12, flags);
+    static void *tiny[2048];
+    int ok = pool != NULL;
+    for (int i = 0; ok && i < 2048; i++) {
+        tiny[i] = balloc(pool, 1);
+        if (!tiny[i] || bsize(pool, tiny[i]) != 2)
+            ok = 0;
+    }
+    for (int i = 0; ok && i < 2048; i++)
+        bfree(pool, tiny[i]);
+    if (ok && !balloc(pool, 4096))
+        ok = 0;
+    if (!ok)
+        printf("FAIL: 2-byte blocks w/flags 0x%02x\n", flags);
+    if (pool)
+        bdelete(pool);
+    return ok;
+}
+
+void test_tree() {
+    printf("=== Test 14: Tree Engine ===\n");
+    int ok = 1;
+    
+    //same odd-sized pool as Test 10, the tree must hand out exactly as many blocks
+    const size_t size = 4096 + 2048 + 16;
+    Balloc pool = bcreatef(size, 4, 12, BALLOC_TREE);
+    static void *blocks[400];
+    int count = 0;
+    while (count < 400 && (blocks[count] = balloc(pool, 16)) != NULL)
+        count++;
+    printf("Tree pool held %d blocks\n", count);
+    if (count != (int)(size / 16)) {
+        printf("FAIL: expected %zu blocks\n", size / 16);
+        ok = 0;
+    }
+    for (int i = 0; i < count; i++)
+        if ((char *)blocks[i] < (char *)bbase(pool) || (char *)blocks[i] + 16 > (char *)bbase(pool) + size)
+            ok = 0;
+    for (int i = 0; i < count; i += 2)
+        bfree(pool, blocks[i]);
+    for (int i = 1; i < count; i += 2)
+        bfree(pool, blocks[i]);
+    void *a = balloc(pool, 4096), *b = balloc(pool, 2048), *c = balloc(pool, 16);
+    if (!a || !b || !c || balloc(pool, 16)) {
+        printf("FAIL: tree pool did not coalesce back\n");
+        ok = 0;
+    }
+    
+    //free blocks are never written to, so a freed block keeps its contents
+    memset(b, 0x5a, 2048);
+    bfree(pool, b);
+    bfree(pool, a);
+    int intact = 1;
+    for (int i = 0; i < 2048; i++)
+        if (((unsigned char *)b)[i] != 0x5a)
+            intact = 0;
+    if (!intact) {
+        printf("FAIL: tree pool wrote inside a free block\n");
+        ok = 0;
+    }
+    bdelete(pool);
+    
+    //free blocks aren't linked through, so blocks can be as small as 2 bytes
+    if (!smallest_order(BALLOC_TREE))
+        ok = 0;
+    
+    //the thread stress from Test 8, on a tree pool
+    stress_pool = bcreatef(1 << 20, 4, 20, BALLOC_THREADSAFE | BALLOC_TREE);
+    stress_errors = 0;
+    pthread_t threads[STRESS_THREADS];
+    for (long i = 0; i < STRESS_THREADS; i++)
+        pthread_create(&threads[i], NULL, stress_thread, (void *)(i + 1));
+    for (int i = 0; i < STRESS_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    void *all = balloc(stress_pool, 1 << 20);
+    if (stress_errors || !all) {
+        printf("FAIL: %d corrupted blocks under threads, %s\n", stress_errors, all ? "coalesced" : "did not coalesce");
+        ok = 0;
+    }
+    bdelete(stress_pool);
+    
+    printf("\nTest 14: %s\n\n", ok ? "PASSED" : "FAILED");
+}
+
+void test_slab() {
+    printf("=== Test 15: Slab Size Classes ===\n");
+    int ok = 1;
+    
+    //64 KiB of 48-byte objects: plain buddy blocks round each one up to 64 bytes
+    const size_t size = 1 << 16;
+    Balloc plain = bcreate(size, 4, 16);
+    Balloc slabs = bcreatef(size, 4, 16, BALLOC_SLAB);
+    static char *objs[2][2000];
+    int count[2] = {0, 0};
+    Balloc pools[2] = {plain, slabs};
+    for (int i = 0; i < 2; i++) {
+        while (count[i] < 2000 && (objs[i][count[i]] = balloc(pools[i], 48)) != NULL)
+            count[i]++;
+    }
+    printf("48-byte objects: %d in plain pool, %d in slab pool\n", count[0], count[1]);
+    if (count[0] != 1024 || count[1] < 1300) {
+        printf("FAIL: slabs did not pack objects densely\n");
+        ok = 0;
+    }
+    
+    //each object is its own 48 bytes, inside the pool
+    for (int j = 0; j < count[1]; j++) {
+        if (bsize(slabs, objs[1][j]) != 48 || objs[1][j] < (char *)bbase(slabs) || objs[1][j] + 48 > (char *)bbase(slabs) + size)
+            ok = 0;
+        memset(objs[1][j], j & 0xff, 48);
+    }
+    for (int j = 0; j < count[1]; j++)
+        if (objs[1][j][0] != (char)(j & 0xff) || objs[1][j][47] != (char)(j & 0xff))
+            ok = 0;
+    if (!ok)
+        printf("FAIL: slab objects overlap or have the wrong size\n");
+    
+    //a pointer into a slab that isn't an object is refused
+    bfree(slabs, objs[1][0] + 8);
+    if (bsize(slabs, objs[1][0] + 8) != 0) {
+        printf("FAIL: bsize accepted a pointer inside an object\n");
+        ok = 0;
+    }
+    
+    //freeing everything gives every slab back, so the pool is whole again
+    for (int j = 0; j < count[1]; j++)
+        bfree(slabs, objs[1][j]);
+    void *all = balloc(slabs, size);
+    if (!all) {
+        printf("FAIL: empty slabs were not returned to the pool\n");
+        ok = 0;
+    }
+    bfree(slabs, all);
+    
+    //odd sizes land in the smallest class that holds them, big ones go to buddy blocks
+    struct {
+        size_t request, expected;
+    } tests[] = {{1, 8}, {8, 8}, {9, 16}, {20, 24}, {90, 96}, {300, 320}, {512, 512}, {513, 1024}};
+    for (int i = 0; i < 8; i++) {
+        void *p = balloc(slabs, tests[i].request);
+        if (bsize(slabs, p) != tests[i].expected) {
+            printf("FAIL: %zu-byte request got %zu bytes, expected %zu\n", tests[i].request, bsize(slabs, p), tests[i].expected);
+            ok = 0;
+        }
+        bfree(slabs, p);
+    }
+    
+    for (int j = 0; j < count[0]; j++)
+        bfree(plain, objs[0][j]);
+    bdelete(plain);
+    bdelete(slabs);
+    
+    //the thread stress from Test 8, on a slab pool
+    stress_pool = bcreatef(1 << 20, 4, 20, BALLOC_THREADSAFE | BALLOC_SLAB);
+    stress_errors = 0;
+    pthread_t threads[STRESS_THREADS];
+    for (long i = 0; i < STRESS_THREADS; i++)
+        pthread_create(&threads[i], NULL, stress_thread, (void *)(i + 1));
+    for (int i = 0; i < STRESS_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    all = balloc(stress_pool, 1 << 20);
+    if (stress_errors || !all) {
+        printf("FAIL: %d corrupted blocks under threads, %s\n", stress_errors, all ? "coalesced" : "did not coalesce");
+        ok = 0;
+    }
+    bdelete(stress_pool);
+    
+    printf("\nTest 15: %s\n\n", ok ? "PASSED" : "FAILED");
+}
+
+void test_realloc() {
+    printf("=== Test 16: In-Place Realloc ===\n");
+    int ok = 1;
+    
+    int flags[2] = {0, BALLOC_TREE};
+    for (int f = 0; f < 2; f++) {
+        Balloc pool = bcreatef(4096, 4, 12, flags[f]);
+        const char *name = f ? "tree" : "free-list";
+        
+        //the first block is the lower buddy at every level, and every upper buddy is free
+        char *a = balloc(pool, 16);
+        memset(a, 'a', 16);
+        char *grown = brealloc(pool, a, 100);
+        if (grown != a || bsize(pool, a) != 128 || memcmp(a, "aaaaaaaaaaaaaaaa", 16)) {
+            printf("FAIL: %s pool did not grow in place\n", name);
+            ok = 0;
+        }
+        
+        //shrinking keeps the pointer and frees the upper halves
+        if (brealloc(pool, a, 20) != a || bsize(pool, a) != 32) {
+            printf("FAIL: %s pool did not shrink in place\n", name);
+            ok = 0;
+        }
+        char *b = balloc(pool, 64);
+        if (b != a + 64) {
+            printf("FAIL: %s pool did not give back the upper half\n", name);
+            ok = 0;
+        }
+        
+        //the upper buddy of a is now b's sibling, allocated, so growing past 64 moves
+        memset(a, 'b', 32);
+        char *moved = brealloc(pool, a, 200);
+        if (moved == NULL || moved == a || bsize(pool, moved) != 256 || memcmp(moved, "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb", 32)) {
+            printf("FAIL: %s pool did not move a block it could not grow\n", name);
+            ok = 0;
+        }
+        
+        //a request larger than the pool fails and leaves the block alone
+        if (brealloc(pool, moved, 8192) != NULL || bsize(pool, moved) != 256) {
+            printf("FAIL: %s pool lost a block on a failed realloc\n", name);
+            ok = 0;
+        }
+        
+        bfree(pool, moved);
+        bfree(pool, b);
+        void *all = balloc(pool, 4096);
+        if (!all) {
+            printf("FAIL: %s pool did not coalesce back\n", name);
+            ok = 0;
+        }
+        bdelete(pool);
+    }
+    
+    //slab objects stay put while they still fit, and move to a block once they don't
+    Balloc pool = bcreatef(1 << 16, 4, 16, BALLOC_SLAB);
+    char *obj = balloc(pool, 40);
+    memset(obj, 'c', 40);
+    if (brealloc(pool, obj, 48) != obj || brealloc(pool, obj, 10) != obj) {
+        printf("FAIL: slab object moved while it still fit\n");
+        ok = 0;
+    }
+    char *big = brealloc(pool, obj, 2000);
+    if (!big || bsize(pool, big) != 2048 || memcmp(big, "cccccccccccccccccccccccccccccccccccccccc", 40)) {
+        printf("FAIL: slab object did not move to a block\n");
+        ok = 0;
+    }
+    bfree(pool, big);
+    bdelete(pool);
+    
+    printf("\nTest 16: %s\n\n", ok ? "PASSED" : "FAILED");
+}
+
+void test_aligned() {
+    printf("=== Test 17: Aligned Allocation ===\n");
+    int ok = 1;
+    
+    //the pool itself is aligned to its largest block, so every block is aligned to its size
+    Balloc pool = bcreatef(1 << 20, 4, 16, BALLOC_SLAB);
+    if ((size_t)bbase(pool) % (1 << 16)) {
+        printf("FAIL: pool base %p is not aligned to 2^16\n", bbase(pool));
+        ok = 0;
+    }
+    
+    struct {
+        size_t size, align, expected;
+    } tests[] = {
+        {24, 8, 24},            //slab object, 8-byte alignment is enough
+        {24, 64, 64},           //alignment picks the order, no padding beyond it
+        {100, 256, 256},
+        {5000, 4096, 8192},
+        {1, 65536, 65536},
+    };
+    for (int i = 0; i < 5; i++) {
+        char *p = balloc_aligned(pool, tests[i].size, tests[i].align);
+        size_t actual = bsize(pool, p);
+        printf("size %5zu align %5zu -> %p, block %5zu (expected %5zu) %s\n", tests[i].size, tests[i].align,
+               (void *)p, actual, tests[i].expected,
+               actual == tests[i].expected && (size_t)p % tests[i].align == 0 ? "OK" : "FAIL");
+        if (actual != tests[i].expected || (size_t)p % tests[i].align) {
+            ok = 0;
+            continue;
+        }
+        memset(p, 0x11, tests[i].size);
+        bfree(pool, p);
+    }
+    
+    //alignments that aren't powers of two, or exceed the largest block, are refused
+    if (balloc_aligned(pool, 16, 48) || balloc_aligned(pool, 16, 0) || balloc_aligned(pool, 16, 1 << 17)) {
+        printf("FAIL: accepted an impossible alignment\n");
+        ok = 0;
+    }
+    
+    bdelete(pool);
+    printf("\nTest 17: %s\n\n", ok ? "PASSED" : "FAILED");
+}
+
+void test_calloc() {
+    printf("=== Test 18: Zero-Aware Calloc ===\n");
+    int ok = 1;
+    
+    int flags[3] = {BALLOC_LAZY, 0, BALLOC_TREE | BALLOC_SLAB};
+    for (int f = 0; f < 3; f++) {
+        Balloc pool = bcreatef(1 << 22, 4, 22, flags[f]);
+        
+        //fresh memory, dirty memory, and memory dirtied around a clean block all come back zero
+        for (int round = 0; round < 3; round++) {
+            char *p = bcalloc(pool, 1 << 10, 1 << 10);
+            if (!p || !zeroed(p, 0, 1 << 20)) {
+                printf("FAIL: round %d of pool %d was not zeroed\n", round, f);
+                ok = 0;
+            }
+            if (p) {
+                memset(p, 0xee, 1 << 20);
+                bfree(pool, p);
+            }
+            if (round == 1)
+                btrim(pool);
+        }
+        
+        //small requests, in slabs or in blocks that free-list links have passed through
+        char *small[64];
+        for (int i = 0; i < 64; i++) {
+            small[i] = balloc(pool, 40);
+            memset(small[i], 0xdd, 40);
+        }
+        for (int i = 0; i < 64; i++)
+            bfree(pool, small[i]);
+        for (int i = 0; i < 64; i++) {
+            small[i] = bcalloc(pool, 5, 8);
+            if (!small[i] || !zeroed(small[i], 0, 40))
+                ok = 0;
+        }
+        for (int i = 0; i < 64; i++)
+            bfree(pool, small[i]);
+        
+        //n * size overflowing is refused
+        if (bcalloc(pool, (size_t)1 << 40, (size_t)1 << 40)) {
+            printf("FAIL: overflowing calloc succeeded\n");
+            ok = 0;
+        }
+        bdelete(pool);
+    }
+    if (!ok)
+        printf("FAIL: bcalloc returned dirty memory\n");
+    
+    printf("\nTest 18: %s\n\n", ok ? "PASSED" : "FAILED");
+}
+
+void test_stats() {
+    printf("=== Test 19: Statistics ===\n");
+    int ok = 1;
+    
+    int flags[4] = {0, BALLOC_LAZY, BALLOC_TREE, BALLOC_SLAB | BALLOC_THREADSAFE};
+    for (int f = 0; f < 4; f++) {
+        Balloc pool = bcreatef(1 << 16, 4, 16, flags[f]);
+        BallocStats s;
+        
+        //two 1 KiB blocks: six splits to get down to 2^10, the second is the first one's buddy
+        void *a = balloc(pool, 1000);
+        void *b = balloc(pool, 1000);
+        bstats(pool, &s);
+        if (s.requested != 2000 || s.granted != 2048 || s.live != 2048 || s.peak != 2048 ||
+            s.levels[10].allocated != 2 || s.levels[10].peak != 2 || s.untouched != 0 ||
+            s.levels[10].requested != 2000 || s.levels[10].granted != 2048 || s.levels[10].live != 2048) {
+            printf("FAIL: pool %d counted %zu requested, %zu granted, %zu blocks\n", f, s.requested, s.granted, s.levels[10].allocated);
+            ok = 0;
+        }
+        for (int e = 11; e <= 16; e++) {
+            if (s.levels[e].splits != 1 || s.levels[e].free != (e < 16))
+                ok = 0;
+        }
+        
+        //freeing both merges back up to one free 2^16 block
+        bfree(pool, a);
+        bfree(pool, b);
+        bstats(pool, &s);
+        size_t merges = 0;
+        for (int e = s.l; e <= s.u; e++) {
+            merges += s.levels[e].merges;
+            if (s.levels[e].allocated != 0 || s.levels[e].free != (e == 16))
+                ok = 0;
+        }
+        if (merges != 6 || s.live != 0 || s.peak != 2048) {
+            printf("FAIL: pool %d counted %zu merges, %zu live\n", f, merges, s.live);
+            ok = 0;
+        }
+        
+        //the peak is the pool's: a 2 KiB block alone, once the two 1 KiB ones are gone, doesn't raise it
+        bfree(pool, balloc(pool, 2000));
+        bstats(pool, &s);
+        if (s.peak != 2048 || s.levels[11].live != 0 || s.levels[11].granted != 2048) {
+            printf("FAIL: pool %d peak %zu after a 2 KiB block alone\n", f, s.peak);
+            ok = 0;
+        }
+        
+        //a block that is taken, and one too big for any pool, both fail
+        void *whole = balloc(pool, 1 << 16);
+        if (balloc(pool, 1 << 16) || balloc(pool, 1 << 17))
+            ok = 0;
+        bstats(pool, &s);
+        if (s.failed != 2 || s.levels[16].fails != 1 || s.levels[16].allocated != 1) {
+            printf("FAIL: pool %d counted %zu failures\n", f, s.failed);
+            ok = 0;
+        }
+        bfree(pool, whole);
+        
+        //small objects live in one slab, counted at the slab's size
+        if (flags[f] & BALLOC_SLAB) {
+            void *objs[8];
+            for (int i = 0; i < 8; i++)
+                objs[i] = balloc(pool, 24);
+            bstats(pool, &s);
+            if (s.objects != 8 || s.levels[12].allocated != 1 || s.live != 8 * 24) {
+                printf("FAIL: %zu objects in %zu slabs\n", s.objects, s.levels[12].allocated);
+                ok = 0;
+            }
+            for (int i = 0; i < 8; i++)
+                bfree(pool, objs[i]);
+            bstats(pool, &s);
+            if (s.objects != 0 || s.levels[12].allocated != 0 || s.live != 0)
+                ok = 0;
+        }
+        
+        //the JSON dump is one object w/a level for each block size
+        char *json;
+        size_t len;
+        FILE *out = open_memstream(&json, &len);
+        bprintjson(pool, out);
+        fclose(out);
+        if (json[0] != '{' || !strstr(json, "\"levels\": [{\"e\": 4,") || !strstr(json, "\"e\": 16,") || json[len - 2] != '}' ||
+            !strstr(json, "\"requested\": 2000, \"granted\": 2048, \"live\": 0,"))
+            ok = 0;
+        if (f == 0)
+            printf("%s", json);
+        free(json);
+        
+        bdelete(pool);
+    }
+    
+    printf("\nTest 19: %s\n\n", ok ? "PASSED" : "FAILED");
+}
+
+void test_shared() {
+    printf("=== Test 20: Shared Pools Across Processes ===\n");
+    int ok = 1;
+    
+    int flags[2] = {BALLOC_SHARED | BALLOC_LAZY | BALLOC_SLAB, BALLOC_SHARED | BALLOC_TREE};
+    for (int f = 0; f < 2; f++) {
+        Balloc pool = bcreatef(1 << 20, 4, 20, flags[f]);
+        if (!pool || bfd(pool) < 0) {
+            printf("FAIL: could not create shared pool %d\n", f);
+            ok = 0;
+            continue;
+        }
+        char *mine = balloc(pool, 100);
+        strcpy(mine, "from parent");
+        
+        //the child attaches at an address of its own, so blocks cross the pipe as offsets from bbase
+        int fds[2];
+        if (pipe(fds)) {
+            ok = 0;
+            bdelete(pool);
+            continue;
+        }
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            Balloc view = battach(bfd(pool));
+            if (!view || bbase(view) == bbase(pool))
+                _exit(1);
+            char *base = bbase(view);
+            
+            //read the parent's block, then free it from here
+            size_t offset = mine - (char *)bbase(pool);
+            if (strcmp(base + offset, "from parent"))
+                _exit(2);
+            bfree(view, base + offset);
+            
+            //hand back blocks and slab objects of several sizes, each filled w/its index
+            size_t offsets[16];
+            for (int i = 0; i < 16; i++) {
+                size_t size = i % 2 ? 40 : 1000 * i + 8;
+                char *p = balloc(view, size);
+                if (!p)
+                    _exit(3);
+                memset(p, i, size);
+                offsets[i] = p - base;
+            }
+            if (write(fds[1], offsets, sizeof(offsets)) != sizeof(offsets))
+                _exit(4);
+            bdelete(view);
+            _exit(0);
+        }
+        
+        int status;
+        size_t offsets[16];
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) ||
+            read(fds[0], offsets, sizeof(offsets)) != sizeof(offsets)) {
+            printf("FAIL: child of pool %d exited w/status %d\n", f, status);
+            ok = 0;
+            bdelete(pool);
+            continue;
+        }
+        close(fds[0]);
+        close(fds[1]);
+        
+        //the child's blocks hold its data here, are all the pool counts live, and free back into it
+        BallocStats s;
+        bstats(pool, &s);
+        size_t live = s.live;
+        for (int i = 0; i < 16; i++) {
+            char *p = (char *)bbase(pool) + offsets[i];
+            size_t size = i % 2 ? 40 : 1000 * i + 8;
+            if (bsize(pool, p) < size || p[0] != i || p[size - 1] != i) {
+                printf("FAIL: block %d of pool %d lost the child's data\n", i, f);
+                ok = 0;
+            }
+            live -= bsize(pool, p);
+            bfree(pool, p);
+        }
+        if (live != 0)
+            ok = 0;
+        bstats(pool, &s);
+        void *whole = balloc(pool, 1 << 20);
+        if (s.live != 0 || s.objects != 0 || !whole) {
+            printf("FAIL: pool %d has %zu bytes live after every block was freed\n", f, s.live);
+            ok = 0;
+        }
+        
+        //purged pages are dropped from the memory file too, so they read back as zero
+        if (whole) {
+            memset(whole, 0xaa, 1 << 20);
+            bfree(pool, whole);
+        }
+        btrim(pool);
+        char *again = bcalloc(pool, 1 << 10, 1 << 10);
+        if (!again || !zeroed(again, 0, 1 << 20)) {
+            printf("FAIL: pool %d kept dirty pages through a purge\n", f);
+            ok = 0;
+        }
+        bdelete(pool);
+    }
+    
+    //a file that isn't a pool is refused
+    int fds[2];
+    if (pipe(fds) == 0) {
+        if (battach(fds[0]))
+            ok = 0;
+        close(fds[0]);
+        close(fds[1]);
+    }
+    
+    printf("\nTest 20: %s\n\n", ok ? "PASSED" : "FAILED");
+}
+
+void test_snapshot() {
+    printf("=== Test 21: Snapshot and Restart ===\n");
+    int ok = 1;
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_balloc.%d.snap", (int)getpid());
+    
+    //three 2^20 blocks, so an eager pool starts w/a free list through pages no owner ever wrote
+    int flags[4] = {0, BALLOC_LAZY | BALLOC_SLAB | BALLOC_THREADSAFE, BALLOC_TREE, BALLOC_SHARED | BALLOC_SLAB};
+    for (int f = 0; f < 4; f++) {
+        Balloc pool = bcreatef(3 << 20, 4, 20, flags[f]);
+        
+        //blocks and slab objects of several sizes, each filled w/its index, and every other one freed
+        size_t offsets[64];
+        for (int i = 0; i < 64; i++) {
+            size_t size = i % 4 ? 24 * i : 1024 * i + 8;
+            char *p = balloc(pool, size);
+            memset(p, i, size);
+            offsets[i] = p - (char *)bbase(pool);
+        }
+        for (int i = 0; i < 64; i += 2)
+            bfree(pool, (char *)bbase(pool) + offsets[i]);
+        BallocStats before, after;
+        bstats(pool, &before);
+        
+        if (bsave(pool, path)) {
+            printf("FAIL: could not save pool %d\n", f);
+            ok = 0;
+            bdelete(pool);
+            continue;
+        }
+        bdelete(pool);
+        
+        //the restarted pool has every block where it was, w/its data, and counts them all
+        pool = bload(path);
+        if (!pool || ((size_t)bbase(pool) & ((1 << 20) - 1))) {
+            printf("FAIL: could not load pool %d\n", f);
+            ok = 0;
+            continue;
+        }
+        bstats(pool, &after);
+        if (after.live != before.live || after.objects != before.objects) {
+            printf("FAIL: pool %d came back w/%zu bytes live, not %zu\n", f, after.live, before.live);
+            ok = 0;
+        }
+        for (int e = 4; e <= 20; e++) {
+            if (after.levels[e].free != before.levels[e].free) {
+                printf("FAIL: pool %d came back w/%zu free 2^%d blocks, not %zu\n", f, after.levels[e].free, e, before.levels[e].free);
+                ok = 0;
+            }
+        }
+        for (int i = 1; i < 64; i += 2) {
+            char *p = (char *)bbase(pool) + offsets[i];
+            size_t size = i % 4 ? 24 * i : 1024 * i + 8;
+            if (bsize(pool, p) < size || p[0] != i || p[size - 1] != i) {
+                printf("FAIL: block %d of pool %d lost its data\n", i, f);
+                ok = 0;
+            }
+            bfree(pool, p);
+        }
+        
+        //freeing every block merges back to whole ones, and purged pages read back as zero, not as the snapshot had them
+        char *whole[3];
+        for (int i = 0; i < 3; i++) {
+            whole[i] = balloc(pool, 1 << 20);
+            if (!whole[i]) {
+                printf("FAIL: pool %d did not merge back after restart\n", f);
+                ok = 0;
+            }
+        }
+        for (int i = 0; i < 3; i++)
+            bfree(pool, whole[i]);
+        btrim(pool);
+        char *again = bcalloc(pool, 1 << 10, 1 << 10);
+        if (!again || !zeroed(again, 0, 1 << 20)) {
+            printf("FAIL: pool %d kept the snapshot's pages through a purge\n", f);
+            ok = 0;
+        }
+        bdelete(pool);
+    }
+    unlink(path);
+    
+    //a missing file, and one that isn't a snapshot, are refused
+    if (bload(path) || bload("/proc/self/status"))
+        ok = 0;
+    
+    printf("\nTest 21: %s\n\n", ok ? "PASSED" : "FAILED");
+}
+
+#define LF_THREADS 8
+
+static int lf_owners[(1 << 20) / 16];     //id of the thread holding each 16-byte granule, 0 if none
+static int lf_overlaps;
+static int lf_nulls;                        //allocations that failed, though the pool can't run out
+static int lf_stop;
+
+//claim (or w/id 0, give up) each granule of the block at p, counting any another thread already holds
+static void lf_own(char *p, size_t size, int id) {
+    size_t first = (p - (char *)bbase(stress_pool)) / 16;
+    for (size_t g = first; g < first + size / 16; g++) {
+        int none = 0;
+        if (!id)
+            __atomic_store_n(&lf_owners[g], 0, __ATOMIC_RELAXED);
+        else if (!__atomic_compare_exchange_n(&lf_owners[g], &none, id, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            __atomic_fetch_add(&lf_overlaps, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*  each thread churns its own blocks, like stress_thread, but also claims every granule of a block
+    w/compare-and-swap as balloc returns it, and gives them up just before bfree
+    two live blocks that overlap, even for an instant, fail the claim, whatever order the lists ran in
+*/
+static void *lf_thread(void *arg) {
+    int id = (int)(long)arg;
+    unsigned int seed = id + 1;
+    unsigned char *live[STRESS_LIVE] = {0};
+    unsigned int sizes[STRESS_LIVE] = {0};
+    
+    for (int i = 0; i < STRESS_ROUNDS; i++) {
+        int slot = rand_r(&seed) % STRESS_LIVE;
+        if (live[slot]) {
+            for (unsigned int j = 0; j < sizes[slot]; j++) {
+                if (live[slot][j] != id) {
+                    __atomic_fetch_add(&stress_errors, 1, __ATOMIC_RELAXED);
+                    break;
+                }
+            }
+            lf_own((char *)live[slot], sizes[slot], 0);
+            bfree(stress_pool, live[slot]);
+            live[slot] = NULL;
+        } else {
+            sizes[slot] = 16 << (rand_r(&seed) % 7);
+            live[slot] = balloc(stress_pool, sizes[slot]);
+            if (!live[slot]) {
+                __atomic_fetch_add(&lf_nulls, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+            lf_own((char *)live[slot], sizes[slot], id);
+            memset(live[slot], id, sizes[slot]);
+        }
+    }
+    
+    for (int slot = 0; slot < STRESS_LIVE; slot++) {
+        if (!live[slot])
+            continue;
+        lf_own((char *)live[slot], sizes[slot], 0);
+        bfree(stress_pool, live[slot]);
+    }
+    return NULL;
+}
+
+//trims the pool over and over while the others churn, a trim must never release a live block's pages
+static void *lf_trimmer(void *arg) {
+    (void)arg;
+    while (!__atomic_load_n(&lf_stop, __ATOMIC_RELAXED))
+        btrim(stress_pool);
+    return NULL;
+}
+
+void test_lockfree() {
+    printf("=== Test 22: Lock-Free Free Lists ===\n");
+    int ok = 1;
+    
+    //lock-free lists can't go in a tree pool, a shared one, or a snapshot
+    if (bcreatef(1 << 20, 4, 20, BALLOC_LOCKFREE | BALLOC_TREE) || bcreatef(1 << 20, 4, 20, BALLOC_LOCKFREE | BALLOC_SHARED)) {
+        printf("FAIL: lock-free pool created w/a tree or shared\n");
+        ok = 0;
+    }
+    
+    //same odd-sized pool as Tests 10 and 14, every 16-byte block handed out, then coalesced back
+    const size_t size = 4096 + 2048 + 16;
+    Balloc pool = bcreatef(size, 4, 12, BALLOC_LOCKFREE);
+    static void *blocks[400];
+    int count = 0;
+    while (count < 400 && (blocks[count] = balloc(pool, 16)) != NULL)
+        count++;
+    printf("Lock-free pool held %d blocks\n", count);
+    if (count != (int)(size / 16)) {
+        printf("FAIL: expected %zu blocks\n", size / 16);
+        ok = 0;
+    }
+    for (int i = 0; i < count; i += 2)
+        bfree(pool, blocks[i]);
+    for (int i = 1; i < count; i += 2)
+        bfree(pool, blocks[i]);
+    void *a = balloc(pool, 4096), *b = balloc(pool, 2048), *c = balloc(pool, 16);
+    if (!a || !b || !c || balloc(pool, 16)) {
+        printf("FAIL: lock-free pool did not coalesce back\n");
+        ok = 0;
+    }
+    
+    //links are out of band too, so a freed block keeps its contents, and grows in place into free buddies
+    memset(b, 0x5a, 2048);
+    bfree(pool, b);
+    int intact = 1;
+    for (int i = 0; i < 2048; i++)
+        if (((unsigned char *)b)[i] != 0x5a)
+            intact = 0;
+    if (!intact || bsave(pool, "/tmp/test_balloc.lf.snap") == 0) {
+        printf("FAIL: lock-free pool wrote inside a free block, or was saved\n");
+        ok = 0;
+    }
+    bdelete(pool);
+    pool = bcreatef(4096, 4, 12, BALLOC_LOCKFREE | BALLOC_LAZY);
+    c = balloc(pool, 16);
+    if (brealloc(pool, c, 2048) != c || brealloc(pool, c, 4096) != c || balloc(pool, 16)) {
+        printf("FAIL: lock-free block did not grow in place\n");
+        ok = 0;
+    }
+    bdelete(pool);
+    
+    //and as small as 2 bytes, but never 2^0, which the order map can't record
+    if (!smallest_order(BALLOC_LOCKFREE))
+        ok = 0;
+    
+    //the thread stress, w/more threads than Test 8, every granule claimed while live, and a trim running throughout
+    //at most 8 x 64 blocks of up to 1 KiB are live, the one asked for aside, in 512 KiB, so at least one 1 KiB block is always
+    //wholly free, and no balloc may fail: a NULL can only be a miss while another thread held free memory out of the lists
+    stress_pool = bcreatef(1 << 19, 4, 19, BALLOC_LOCKFREE);
+    stress_errors = 0;
+    lf_overlaps = 0;
+    lf_nulls = 0;
+    lf_stop = 0;
+    pthread_t threads[LF_THREADS], trimmer;
+    for (long i = 0; i < LF_THREADS; i++)
+        pthread_create(&threads[i], NULL, lf_thread, (void *)(i + 1));
+    pthread_create(&trimmer, NULL, lf_trimmer, NULL);
+    for (int i = 0; i < LF_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    __atomic_store_n(&lf_stop, 1, __ATOMIC_RELAXED);
+    pthread_join(trimmer, NULL);
+    printf("%d threads x %d operations, %d overlapping blocks, %d corrupted blocks, %d failed allocations\n",
+           LF_THREADS, STRESS_ROUNDS, lf_overlaps, stress_errors, lf_nulls);
+    
+    //nothing is live, and every block coalesced back into one
+    BallocStats s;
+    bstats(stress_pool, &s);
+    void *all = balloc(stress_pool, 1 << 19);
+    if (lf_overlaps || stress_errors || lf_nulls || s.live || !all) {
+        printf("FAIL: %zu bytes still live, %s\n", s.live, all ? "coalesced" : "did not coalesce");
+        ok = 0;
+    }
+    bdelete(stress_pool);
+    
+    printf("\nTest 22: %s\n\n", ok ? "PASSED" : "FAILED");
+}
+
+#define SHARDS 4
+
+void test_percpu() {
+    printf("=== Test 23: Per-CPU Shards ===\n");
+    int ok = 1;
+    
+    //shards can't live in a memory file
+    if (bcreatef(1 << 20, 4, 20, BALLOC_PERCPU | BALLOC_SHARED)) {
+        printf("FAIL: per-CPU pool created shared\n");
+        ok = 0;
+    }
+    
+    //one shard per CPU, whatever this machine has
+    Balloc pool = bcreatef(1 << 24, 4, 20, BALLOC_PERCPU | BALLOC_LAZY);
+    void *one = balloc(pool, 100);
+    if (!pool || !one || bsize(pool, one) != 128) {
+        printf("FAIL: per-CPU pool did not allocate\n");
+        ok = 0;
+    }
+    bfree(pool, one);
+    bdelete(pool);
+    
+    //four shards of 2^20, more than this may have CPUs, so threads here share a shard, and fill the others by stealing
+    pool = bcreateshards(SHARDS << 20, 4, 20, BALLOC_LAZY, SHARDS);
+    char *base = bbase(pool);
+    static void *blocks[SHARDS * 256 + 1];
+    int count = 0, per[SHARDS] = {0};
+    while (count < SHARDS * 256 + 1 && (blocks[count] = balloc(pool, 4096)) != NULL)
+        count++;
+    printf("Per-CPU pool held %d blocks\n", count);
+    for (int i = 0; i < count; i++) {
+        size_t offset = (char *)blocks[i] - base;
+        if (offset >= SHARDS << 20 || (offset & 4095) || bsize(pool, blocks[i]) != 4096)
+            ok = 0;
+        else
+            per[offset >> 20]++;
+    }
+    for (int i = 0; i < SHARDS; i++) {
+        if (per[i] != 256) {
+            printf("FAIL: shard %d held %d blocks, not 256\n", i, per[i]);
+            ok = 0;
+        }
+    }
+    BallocStats s;
+    bstats(pool, &s);
+    if (count != SHARDS * 256 || s.live != SHARDS << 20 || s.levels[12].allocated != SHARDS * 256 || bsave(pool, "/tmp/test_balloc.shards.snap") == 0) {
+        printf("FAIL: expected %d blocks, all counted, and no snapshot\n", SHARDS * 256);
+        ok = 0;
+    }
+    
+    //every block goes back to its own shard, in bulk or not, and each coalesces back to one block
+    bfree_bulk(pool, blocks, count / 2);
+    for (int i = count / 2; i < count; i++)
+        bfree(pool, blocks[i]);
+    void *whole[SHARDS + 1];
+    for (int i = 0; i <= SHARDS; i++)
+        whole[i] = balloc(pool, 1 << 20);
+    for (int i = 0; i < SHARDS; i++) {
+        if (!whole[i]) {
+            printf("FAIL: shards did not coalesce back\n");
+            ok = 0;
+        }
+    }
+    if (whole[SHARDS])
+        ok = 0;
+    
+    //a block that can't grow in its own shard moves to one w/room
+    bfree(pool, whole[SHARDS - 1]);
+    char *a = balloc(pool, 16), *b = balloc(pool, 16);
+    bfree(pool, whole[0]);
+    memset(a, 0x5a, 16);
+    char *grown = brealloc(pool, a, 1 << 20);
+    if (grown != whole[0] || grown[15] != 0x5a || bsize(pool, a) || bsize(pool, grown) != 1 << 20) {
+        printf("FAIL: block did not move to a shard w/room\n");
+        ok = 0;
+    }
+    bfree(pool, b);
+    bfree(pool, grown);
+    for (int i = 1; i < SHARDS - 1; i++)
+        bfree(pool, whole[i]);
+    bdelete(pool);
+    
+    //the thread stress from Test 8, w/shards too small for one thread's blocks, so threads steal and free into each other's shards
+    stress_pool = bcreateshards(SHARDS << 15, 4, 15, 0, SHARDS);
+    stress_errors = 0;
+    pthread_t threads[STRESS_THREADS];
+    for (long i = 0; i < STRESS_THREADS; i++)
+        pthread_create(&threads[i], NULL, stress_thread, (void *)(i + 1));
+    for (int i = 0; i < STRESS_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    bstats(stress_pool, &s);
+    printf("%d threads x %d operations, %zu misses in a full shard\n", STRESS_THREADS, STRESS_ROUNDS, s.failed);
+    for (int i = 0; i < SHARDS; i++) {
+        whole[i] = balloc(stress_pool, 1 << 15);
+        if (!whole[i])
+            ok = 0;
+    }
+    if (stress_errors || !ok)
+        printf("FAIL: %d corrupted blocks under threads, or shards did not coalesce\n", stress_errors);
+    ok = ok && !stress_errors;
+    bdelete(stress_pool);
+    
+    printf("\nTest 23: %s\n\n", ok ? "PASSED" : "FAILED");
+}
+
+void test_defer() {
+    printf("=== Test 24: Deferred Coalescing ===\n");
+    int ok = 1;
+    
+    if (bcreatef(1 << 20, 4, 20, BALLOC_DEFER | BALLOC_TREE) || bcreatef(1 << 20, 4, 20, BALLOC_DEFER | BALLOC_LOCKFREE)) {
+        printf("FAIL: deferred pool created w/a tree or lock-free lists\n");
+        ok = 0;
+    }
+    
+    //free and reallocate one size: eagerly, every cycle merges all the way up and splits all the way down again
+    BallocStats s[2];
+    for (int d = 0; d < 2; d++) {
+        Balloc pool = bcreatef(1 << 20, 4, 20, BALLOC_LAZY | (d ? BALLOC_DEFER : 0));
+        void *a = balloc(pool, 16), *first = a;
+        for (int i = 0; i < 1000 && a == first; i++) {
+            bfree(pool, a);
+            a = balloc(pool, 16);
+        }
+        if (a != first)
+            ok = 0;
+        bstats(pool, &s[d]);
+        bdelete(pool);
+    }
+    size_t splits[2] = {0}, merges[2] = {0};
+    for (int d = 0; d < 2; d++) {
+        for (int e = 4; e <= 20; e++) {
+            splits[d] += s[d].levels[e].splits;
+            merges[d] += s[d].levels[e].merges;
+        }
+    }
+    printf("1000 free/alloc cycles: %zu splits, %zu merges eager, %zu splits, %zu merges deferred\n",
+           splits[0], merges[0], splits[1], merges[1]);
+    if (splits[0] != 16 * 1001 || merges[0] != 16 * 1000 || splits[1] != 16 || merges[1] != 0) {
+        printf("FAIL: deferred pool split or merged on churn\n");
+        ok = 0;
+    }
+    
+    //crossing a level's watermark coalesces everything it held, as one batch
+    Balloc pool = bcreatef(1 << 20, 4, 20, BALLOC_LAZY | BALLOC_DEFER);
+    bsetdefer(pool, 4, 2);
+    char *b[4];
+    for (int i = 0; i < 4; i++)
+        b[i] = balloc(pool, 16);
+    bfree(pool, b[0]);
+    bfree(pool, b[1]);
+    bstats(pool, &s[0]);
+    bfree(pool, b[2]);
+    bstats(pool, &s[1]);
+    if (s[0].levels[4].free != 2 || s[0].levels[4].merges != 0 || s[1].levels[4].merges != 1 || s[1].levels[4].free != 1 ||
+        balloc(pool, 32) != b[0]) {
+        printf("FAIL: watermark did not coalesce the level's deferred blocks\n");
+        ok = 0;
+    }
+    bdelete(pool);
+    
+    //an allocation no list can serve coalesces every deferred block, in a snapshot too
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_balloc.%d.snap", (int)getpid());
+    pool = bcreatef(4096, 4, 12, BALLOC_DEFER);
+    static void *blocks[256];
+    for (int i = 0; i < 256; i++)
+        blocks[i] = balloc(pool, 16);
+    for (int i = 0; i < 256; i++)
+        bfree(pool, blocks[i]);
+    bstats(pool, &s[0]);
+    if (bsave(pool, path)) {
+        printf("FAIL: could not save deferred pool\n");
+        ok = 0;
+    }
+    void *all = balloc(pool, 4096);
+    if (s[0].levels[4].free != 256 || all != bbase(pool)) {
+        printf("FAIL: deferred blocks were not coalesced for a larger block\n");
+        ok = 0;
+    }
+    bdelete(pool);
+    pool = bload(path);
+    unlink(path);
+    bstats(pool, &s[1]);
+    all = pool ? balloc(pool, 4096) : NULL;
+    if (s[1].levels[4].free != 256 || !all) {
+        printf("FAIL: deferred blocks did not survive a snapshot\n");
+        ok = 0;
+    }
+    bdelete(pool);
+    
+    //the thread stress from Test 8, on a deferred pool, which must still coalesce back to one block
+    stress_pool = bcreatef(1 << 20, 4, 20, BALLOC_THREADSAFE | BALLOC_DEFER);
+    stress_errors = 0;
+    pthread_t threads[STRESS_THREADS];
+    for (long i = 0; i < STRESS_THREADS; i++)
+        pthread_create(&threads[i], NULL, stress_thread, (void *)(i + 1));
+    for (int i = 0; i < STRESS_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    all = balloc(stress_pool, 1 << 20);
+    if (stress_errors || !all) {
+        printf("FAIL: %d corrupted blocks under threads, %s\n", stress_errors, all ? "coalesced" : "did not coalesce");
+        ok = 0;
+    }
+    bdelete(stress_pool);
+    
+    printf("\nTest 24: %s\n\n", ok ? "PASSED" : "FAILED");
+}
+
+//bytes from addr to the end of this process's mapping that holds it, 0 if none
+static size_t mapped(void *addr) {
+    FILE *f = fopen("/proc/self/maps", "r");
+    unsigned long lo, hi, at = (unsigned long)addr;
+    size_t extent = 0;
+    char line[512];
+    while (f && !extent && fgets(line, sizeof(line), f))
+        if (sscanf(line, "%lx-%lx", &lo, &hi) == 2 && lo <= at && at < hi)
+            extent = hi - at;
+    if (f)
+        fclose(f);
+    return extent;
+}
+
+void test_metadata() {
+    printf("=== Test 25: Metadata in One Mapping ===\n");
+    int ok = 1;
+    
+    //a private pool's structure is in its metadata mapping, w/every level's lists, bitmaps and locks
+    //look for that mapping and the pool's own memory, rather than counting mappings, which other code in the process may add or drop
+    //the pool structure comes first in its mapping, which must go on past it for at least the order map, one byte per 2^4 granule
+    int flags[6] = {0, BALLOC_LAZY, BALLOC_THREADSAFE | BALLOC_SLAB, BALLOC_TREE, BALLOC_LOCKFREE, BALLOC_DEFER};
+    for (int i = 0; i < 6; i++) {
+        Balloc pool = bcreatef(1 << 24, 4, 20, flags[i]);
+        if (!pool) {
+            printf("FAIL: could not create pool w/flags 0x%02x\n", flags[i]);
+            ok = 0;
+            continue;
+        }
+        void *base = bbase(pool);
+        int during = mapped(pool) >= (1 << 24 >> 4) && mapped(base) >= (1 << 24);
+        void *a = balloc(pool, 16), *b = balloc(pool, 1 << 20);
+        if (!a || !b)
+            ok = 0;
+        bfree(pool, a);
+        bfree(pool, b);
+        bdelete(pool);
+        int after = mapped(pool) || mapped(base);
+        printf("flags 0x%02x: metadata and pool %s, %s after bdelete\n", flags[i],
+               during ? "mapped" : "missing", after ? "still mapped" : "unmapped");
+        if (!during || after) {
+            printf("FAIL: pool metadata or memory not mapped while live, or left behind\n");
+            ok = 0;
+        }
+    }
+    
+    printf("\nTest 25: %s\n\n", ok ? "PASSED" : "FAILED");
+}
+
+void test_heap() {
+    printf("=== Test 26: Growable Heap ===\n");
+    int ok = 1;
+    Heap h = heapcreate(4, 16), other = heapcreate(4, 16);
+    
+    //the page map finds the arena of any block, and a heap claims no one else's pointers
+    int local;
+    void *a = heapalloc(h, 100), *b = heapalloc(other, 100);
+    if (heapsize(h, a) != 128 || heapsize(other, b) != 128 || heapsize(h, b) != 0 || heapsize(h, &local) != 0) {
+        printf("FAIL: page map found the wrong owner\n");
+        ok = 0;
+    }
+    
+    //a foreign pointer is ignored by free and realloc alike
+    void *foreign = malloc(100);
+    heapfree(h, foreign);
+    heapfree(h, &local);
+    heapfree(h, b);
+    if (heaprealloc(h, foreign, 200) != NULL || heapsize(other, b) != 128) {
+        printf("FAIL: heap touched a pointer it doesn't own\n");
+        ok = 0;
+    }
+    free(foreign);
+    heapfree(other, b);
+    heapfree(h, a);
+    
+    //requests bigger than an arena get their own region of whole pages, found by its first byte only
+    char *big = heapalloc(h, (1 << 16) + 1);
+    if (!big || heapsize(h, big) != 17 * 4096 || heapsize(h, big + 1) || heapsize(h, big + 4096)) {
+        printf("FAIL: large region is %zu bytes\n", big ? heapsize(h, big) : 0);
+        ok = 0;
+    } else {
+        big[1 << 16] = 1;
+        heapfree(h, big);
+        if (heapsize(h, big) != 0)
+            ok = 0;
+    }
+    void *aligned = heapalign(h, 100, 1 << 17);
+    if (!aligned || ((size_t)aligned & ((1 << 17) - 1)) || heapsize(h, aligned) != 4096) {
+        printf("FAIL: aligned large region at %p\n", aligned);
+        ok = 0;
+    }
+    heapfree(h, aligned);
+    
+    //realloc moves a block out to a region of its own, and back into an arena, keeping its bytes
+    char *p = heapalloc(h, 100);
+    strcpy(p, "buddy");
+    p = heaprealloc(h, p, 1 << 17);
+    if (!p || heapsize(h, p) != 1 << 17 || strcmp(p, "buddy")) {
+        printf("FAIL: realloc to a large region\n");
+        ok = 0;
+    }
+    p = p ? heaprealloc(h, p, 100) : NULL;
+    if (!p || heapsize(h, p) != 128 || strcmp(p, "buddy")) {
+        printf("FAIL: realloc back into an arena\n");
+        ok = 0;
+    }
+    heapfree(h, p);
+    heapdelete(other);
+    heapdelete(h);
+    
+    //four whole-arena blocks fill four arenas, and a small block then finds them full and grows a fifth
+    Heap g = heapcreate(4, 16);
+    void *whole[4];
+    for (int i = 0; i < 4; i++) {
+        whole[i] = heapalloc(g, 1 << 16);
+        for (int j = 0; j < i; j++) {
+            if (whole[i] == whole[j])
+                ok = 0;
+        }
+        if (!whole[i] || heapsize(g, whole[i]) != 1 << 16)
+            ok = 0;
+    }
+    char *small = heapalloc(g, 16);
+    for (int i = 0; i < 4; i++) {
+        if (!small || (small >= (char *)whole[i] && small < (char *)whole[i] + (1 << 16)))
+            ok = 0;
+    }
+    
+    //freeing one reopens its arena, which the next request finds instead of growing
+    heapfree(g, whole[1]);
+    void *again = heapalloc(g, 1 << 16);
+    BallocStats s;
+    heapstats(g, &s);
+    size_t held = s.live + s.untouched;
+    for (int e = s.l; e <= s.u; e++)
+        held += s.levels[e].free << e;
+    printf("%zu arenas: %zu bytes live, the freed arena %s\n", held >> 16, s.live, again == whole[1] ? "reused" : "skipped");
+    if (again != whole[1] || s.live != 4 * (1 << 16) + 16 || held != 5 << 16) {
+        printf("FAIL: heap grew past an arena w/room\n");
+        ok = 0;
+    }
+    heapdelete(g);
+    
+    //a bulk request runs on into a second arena, and a bulk free gives both back whole
+    g = heapcreate(4, 16);
+    static void *many[5000];
+    size_t got = heapalloc_bulk(g, 16, 5000, many);
+    heapstats(g, &s);
+    size_t live = s.live;
+    heapfree_bulk(g, many, got);
+    void *two[2] = {heapalloc(g, 1 << 16), heapalloc(g, 1 << 16)};
+    heapstats(g, &s);
+    held = s.live + s.untouched;
+    for (int e = s.l; e <= s.u; e++)
+        held += s.levels[e].free << e;
+    if (got != 5000 || live != 5000 * 16 || !two[0] || !two[1] || s.live != 2 << 16 || held != 2 << 16) {
+        printf("FAIL: bulk got %zu blocks, %zu bytes live, then %zu arenas\n", got, live, held >> 16);
+        ok = 0;
+    }
+    heapdelete(g);
+    
+    printf("\nTest 26: %s\n\n", ok ? "PASSED" : "FAILED");
+}
+
+// The malloc wrapper, built in w/its entry points renamed, so the rest of the suite keeps the C library's malloc
+#define malloc         wmalloc
+#define free           wfree
+#define calloc         wcalloc
+#define realloc        wrealloc
+#define posix_memalign wposix_memalign
+#define aligned_alloc  waligned_alloc
+#define memalign       wmemalign
+#define valloc         wvalloc
+#include "wrapper.c"
+#undef malloc
+#undef free
+#undef calloc
+#undef realloc
+#undef posix_memalign
+#undef aligned_alloc
+#undef memalign
+#undef valloc
+
+//free blocks handed out by another thread, and exit
+static void *wrapper_freeer(void *arg) {
+    void **blocks = arg;
+    for (int i = 0; i < 16; i++)
+        wfree(blocks[i]);
+    return NULL;
+}
+
+void test_wrapper() {
+    printf("=== Test 27: Malloc Wrapper ===\n");
+    int ok = 1;
+    
+    //a pointer the C library handed out is left alone
+    char *foreign = malloc(64);
+    wfree(foreign);
+    if (wrealloc(foreign, 128) != NULL) {
+        printf("FAIL: wrapper resized a foreign pointer\n");
+        ok = 0;
+    }
+    free(foreign);
+    
+    //realloc takes a cached small block out to a region bigger than an arena, and back
+    char *p = wmalloc(24);
+    strcpy(p, "buddy");
+    p = wrealloc(p, 2 * e2size(HEAPU));
+    if (!p || heapsize(hp, p) != 2 * e2size(HEAPU) || strcmp(p, "buddy")) {
+        printf("FAIL: realloc to a large region\n");
+        ok = 0;
+    }
+    p = p ? wrealloc(p, 24) : NULL;
+    if (!p || heapsize(hp, p) != 32 || strcmp(p, "buddy")) {
+        printf("FAIL: realloc back to a small block\n");
+        ok = 0;
+    }
+    wfree(p);
+    
+    //calloc zeroes, and aligned requests are aligned, from the caches or not
+    int *zero = wcalloc(100, sizeof(int));
+    for (int i = 0; zero && i < 100; i++) {
+        if (zero[i])
+            ok = 0;
+    }
+    void *al[2] = {0};
+    if (!zero || wposix_memalign(&al[0], 256, 24) || wposix_memalign(&al[1], 1 << 16, 24) ||
+        ((size_t)al[0] & 255) || ((size_t)al[1] & 0xffff)) {
+        printf("FAIL: calloc or posix_memalign\n");
+        ok = 0;
+    }
+    wfree(zero);
+    wfree(al[0]);
+    wfree(al[1]);
+    
+    //an empty magazine is refilled w/half a magazine at once, and not again until it runs out
+    Magazine *m = &cache.mags[order(64) - CACHEL];
+    void *held[BATCH];
+    flush(m, order(64), MAGSIZE);
+    int refills = 0;
+    for (int i = 0; i < BATCH; i++) {
+        refills += m->n == 0;
+        held[i] = wmalloc(64);
+    }
+    if (refills != 1 || m->n != 0) {
+        printf("FAIL: %d refills for a batch, %d left\n", refills, m->n);
+        ok = 0;
+    }
+    for (int i = 0; i < BATCH; i++)
+        wfree(held[i]);
+    
+    //a thread that only frees still flushes its magazines when it exits
+    void *blocks[16];
+    BallocStats before, after;
+    heapstats(hp, &before);
+    size_t cached = cache.bytes;
+    for (int i = 0; i < 16; i++)
+        blocks[i] = wmalloc(512);
+    pthread_t t;
+    pthread_create(&t, NULL, wrapper_freeer, blocks);
+    pthread_join(t, NULL);
+    heapstats(hp, &after);
+    
+    //all the heap still has out beyond what it had before is what this thread's own cache took
+    size_t kept = after.live - before.live - (cache.bytes - cached);
+    printf("free-only thread: %zu bytes left in its cache after it exited\n", kept);
+    if (kept) {
+        printf("FAIL: free-only thread left blocks in its cache\n");
+        ok = 0;
+    }
+    
+    printf("\nTest 27: %s\n\n", ok ? "PASSED" : "FAILED");
+}
+
+// The replay tool, built in w/its main renamed
+#define main replay_main
+#include "replay.c"
+#undef main
+
+void test_trace() {
+    printf("=== Test 28: Trace and Replay ===\n");
+    int ok = 1;
+    char path[64], out[64];
+    snprintf(path, sizeof(path), "/tmp/test_balloc.%d.trace", (int)getpid());
+    snprintf(out, sizeof(out), "/tmp/test_balloc.%d.replay", (int)getpid());
+    
+    //a child starts the wrapper over w/BALLOC_TRACE set, makes a short run through it, and stops recording as it would at exit
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        setenv("BALLOC_TRACE", path, 1);
+        hponce = (pthread_once_t)PTHREAD_ONCE_INIT;
+        hp = 0;
+        cache = (Cache){0};
+        char *a = wmalloc(100), *b = wcalloc(10, 24);
+        a = wrealloc(a, 5000);
+        void *small[32];
+        for (int i = 0; i < 32; i++)
+            small[i] = wmalloc(64);
+        for (int i = 0; i < 32; i++)
+            wfree(small[i]);
+        wfree(a);
+        wfree(b);
+        traceend();
+        _exit(tr == 0 && a && b ? 0 : 1);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        printf("FAIL: recording run failed\n");
+        ok = 0;
+    }
+    
+    //replay it against a 2^20 pool, w/its report going to a file
+    int fd = open(out, O_RDWR | O_CREAT | O_TRUNC, 0600), saved = dup(1);
+    dup2(fd, 1);
+    char *argv[] = {"replay", path, "20", "4", NULL};
+    int rc = replay_main(4, argv);
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+    close(fd);
+    
+    //every record becomes an op but the realloc's second, 34 blocks in all, and the peak is the realloc'd block,
+    //the calloc'd one and all 32 small ones: 8192 + 256 + 32 * 64 bytes, 10 KiB
+    size_t n = 0, ops = 0, ids = 0, dropped = 1, peak = 0, fails = 1;
+    FILE *f = fopen(out, "r");
+    char line[256];
+    while (f && fgets(line, sizeof(line), f)) {
+        sscanf(line, "Trace: %zu records over %*f s, %zu ops on %zu blocks, %zu dropped", &n, &ops, &ids, &dropped);
+        sscanf(line, "Peak granted: %zu KiB, peak footprint: %*u KiB, failed calls: %zu", &peak, &fails);
+    }
+    if (f)
+        fclose(f);
+    printf("replay: %zu records, %zu ops on %zu blocks, %zu dropped, peak %zu KiB, %zu failed\n", n, ops, ids, dropped, peak, fails);
+    if (rc || n != 70 || ops != 69 || ids != 34 || dropped || peak != 10 || fails) {
+        printf("FAIL: replay didn't match the recorded run\n");
+        ok = 0;
+    }
+    unlink(path);
+    unlink(out);
+    
+    printf("\nTest 28: %s\n\n", ok ? "PASSED" : "FAILED");
+}
+
 int main() {
     printf("Buddy System Allocator Test Suite\n");
     printf("==================================\n\n");
@@ -236,6 +2025,28 @@ int main() {
     test_fragmentation();
     test_exhaustion();
     test_write_read();
+    test_size_lookup();
+    test_thread_stress();
+    test_large_pools();
+    test_lazy_init();
+    test_trim();
+    test_bulk();
+    test_bitmap();
+    test_tree();
+    test_slab();
+    test_realloc();
+    test_aligned();
+    test_calloc();
+    test_stats();
+    test_shared();
+    test_snapshot();
+    test_lockfree();
+    test_percpu();
+    test_defer();
+    test_metadata();
+    test_heap();
+    test_wrapper();
+    test_trace();
     
     printf("==================================\n");
     printf("All tests completed!\n");
@@ -0,0 +1,188 @@
+/* Author: Zella Running
+ * Description: Writes allocation traces through shared file mappings, one 1 MiB window at a time, so recording a call is a slot reservation and a few stores. Also maps a finished trace back in for replay.
+ * Class: CS 451 - HW2 Memory Allocator w/Buddy System
+ * Date: 2026 February 11
+ */
+#include "trace.h"
+#include "utils.h"
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAGIC       "BALLOCTR"
+#define VERSION     1
+#define WINDOWSHIFT 20                      //file is mapped 2^20 bytes at a time
+#define WINDOWRECS  (e2size(WINDOWSHIFT) / sizeof(TraceRecord))
+#define MAXWINDOWS  65536                   //traces stop growing at 64 GiB
+
+// Header structure: record 0 of every trace file
+typedef struct {
+    char magic[8];
+    uint64_t version;
+    uint64_t count;             //records that follow, written when recording stops
+    uint64_t unused;
+} Header;
+
+// Trace structure: a trace being recorded, or one mapped for reading
+typedef struct {
+    int fd;
+    int writing;                //1 while recording
+    uint64_t start;             //clock when recording started, in ns
+    size_t next;                //next free record slot, slot 0 is the header
+    pthread_mutex_t grow;       //serializes mapping new windows
+    size_t length;              //bytes of file mapped for reading
+    TraceRecord *windows[MAXWINDOWS];   //w/reading, windows[0] maps the whole file
+} TraceT;
+
+//monotonic clock in ns
+static uint64_t nowns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*  (1) under the grow lock, check no other thread mapped window w first
+    (2) grow the file to cover it, and map it shared, so its pages go to the file w/o any write calls
+    (3) return pointer to window, or NULL on failure
+*/
+static TraceRecord *window(TraceT *t, size_t w){
+    pthread_mutex_lock(&t->grow);
+    TraceRecord *win = t->windows[w];
+    if (!win){
+        off_t offset = (off_t)w << WINDOWSHIFT;
+        struct stat st;
+        if (fstat(t->fd, &st) == 0 && (st.st_size >= offset + (off_t)e2size(WINDOWSHIFT) ||
+                                       ftruncate(t->fd, offset + e2size(WINDOWSHIFT)) == 0)){
+            win = mmap(NULL, e2size(WINDOWSHIFT), PROT_READ | PROT_WRITE, MAP_SHARED, t->fd, offset);
+            if (win == MAP_FAILED)
+                win = NULL;
+            else
+                __atomic_store_n(&t->windows[w], win, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&t->grow);
+    return win;
+}
+
+/*  (1) create trace structure w/mmalloc, so the malloc wrapper can record its own startup
+    (2) create the file, map its first window, and write the header
+    (3) return pointer to trace, or NULL on failure
+*/
+extern Trace tracecreate(const char *path){
+    TraceT *t = mmalloc(sizeof(TraceT));
+    if ((long)t == -1)
+        return NULL;
+
+    t->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (t->fd < 0){
+        mmfree(t, sizeof(TraceT));
+        return NULL;
+    }
+    pthread_mutex_init(&t->grow, NULL);
+
+    Header *h = (Header *)window(t, 0);
+    if (!h){
+        close(t->fd);
+        mmfree(t, sizeof(TraceT));
+        return NULL;
+    }
+    memcpy(h->magic, MAGIC, sizeof(h->magic));
+    h->version = VERSION;
+
+    t->writing = 1;
+    t->start = nowns();
+    t->next = 1;
+    return t;
+}
+
+/*  (1) reserve the next record slot w/one atomic add, so threads never wait on each other
+    (2) map the slot's window if no thread has yet
+    (3) fill in time, op, size and the record's number
+    (4) return record, for the caller to fill in ptr, or NULL if the trace is full
+    slots are in the order calls reserve them, so reserve after a call hands a block out,
+    and before a call gives one back, and a block's calls stay in order across threads
+*/
+extern TraceRecord *tracenext(Trace trace, int op, size_t size){
+    TraceT *t = trace;
+    size_t slot = __atomic_fetch_add(&t->next, 1, __ATOMIC_RELAXED);
+    size_t w = slot / WINDOWRECS;
+    if (w >= MAXWINDOWS)
+        return NULL;
+
+    TraceRecord *win = __atomic_load_n(&t->windows[w], __ATOMIC_ACQUIRE);
+    if (!win && !(win = window(t, w)))
+        return NULL;
+
+    TraceRecord *r = &win[slot % WINDOWRECS];
+    r->ns = nowns() - t->start;
+    r->op = op;
+    r->size = size < UINT32_MAX ? size : UINT32_MAX;
+    r->ref = slot - 1;
+    return r;
+}
+
+/*  (1) map a whole trace file read-only
+    (2) check its header
+    (3) return pointer to trace, or NULL if the file isn't a trace
+*/
+extern Trace traceopen(const char *path){
+    TraceT *t = mmalloc(sizeof(TraceT));
+    if ((long)t == -1)
+        return NULL;
+
+    struct stat st;
+    t->fd = open(path, O_RDONLY);
+    if (t->fd < 0 || fstat(t->fd, &st) || st.st_size < (off_t)sizeof(Header)){
+        if (t->fd >= 0)
+            close(t->fd);
+        mmfree(t, sizeof(TraceT));
+        return NULL;
+    }
+
+    t->length = st.st_size;
+    t->windows[0] = mmap(NULL, t->length, PROT_READ, MAP_PRIVATE, t->fd, 0);
+    Header *h = (Header *)t->windows[0];
+    if (t->windows[0] == MAP_FAILED || memcmp(h->magic, MAGIC, sizeof(h->magic)) || h->version != VERSION){
+        if (t->windows[0] != MAP_FAILED)
+            munmap(t->windows[0], t->length);
+        close(t->fd);
+        mmfree(t, sizeof(TraceT));
+        return NULL;
+    }
+    return t;
+}
+
+/*  (1) find the records after the header, as many as it counts and the file holds
+    (2) return pointer to first record, w/their number in *n
+*/
+extern TraceRecord *tracerecords(Trace trace, size_t *n){
+    TraceT *t = trace;
+    Header *h = (Header *)t->windows[0];
+    size_t fits = t->length / sizeof(TraceRecord) - 1;
+    *n = h->count < fits ? h->count : fits;
+    return t->windows[0] + 1;
+}
+
+/*  (1) recording: write the record count into the header, and stop
+        windows stay mapped, since threads still running may write a last record,
+        and the kernel writes their pages back to the file once the process exits
+    (2) reading: unmap the file and free the trace structure
+    (3) return nothing
+*/
+extern void traceclose(Trace trace){
+    TraceT *t = trace;
+    if (t->writing){
+        Header *h = (Header *)t->windows[0];
+        size_t n = __atomic_load_n(&t->next, __ATOMIC_RELAXED) - 1;
+        size_t most = MAXWINDOWS * WINDOWRECS - 1;
+        h->count = n < most ? n : most;
+        return;
+    }
+    munmap(t->windows[0], t->length);
+    close(t->fd);
+    mmfree(t, sizeof(TraceT));
+}
@@ -0,0 +1,37 @@
+// Allocation traces: recorded by the malloc wrapper, replayed against a pool.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define TRACE_MALLOC  1         // size bytes at ptr
+#define TRACE_CALLOC  2         // size zeroed bytes at ptr
+#define TRACE_FREE    3         // ptr given back
+#define TRACE_REALLOC 4         // ptr to be resized to size bytes
+#define TRACE_RESIZED 5         // the realloc at record ref returned ptr, 0 if it failed
+
+// One call, 32 bytes. ptr is an address in the recorded process, and identifies
+// a block for as long as it is allocated. A realloc is two records, one made
+// before the call, while the old block is still held, and one after, once the
+// new one is. Record 0 of a file is the header, records are numbered after it.
+typedef struct {
+    uint64_t ns;                // time since recording started
+    uint64_t ptr;               // block handed out, or given back
+    uint64_t ref;               // number of this record, or w/TRACE_RESIZED, of its TRACE_REALLOC
+    uint32_t size;              // bytes asked for, capped at 2^32-1, 0 for free
+    uint32_t op;
+} TraceRecord;
+
+typedef void *Trace;
+
+extern Trace        tracecreate(const char *path);
+extern TraceRecord *tracenext(Trace t, int op, size_t size);
+
+extern Trace        traceopen(const char *path);
+extern TraceRecord *tracerecords(Trace t, size_t *n);
+
+extern void traceclose(Trace t);
+
+#endif
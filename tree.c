@@ -0,0 +1,225 @@
+/* Author: Zella Running
+ * Description: Keeps free space out of band in an implicit binary tree, one byte per block at every level, holding the largest free order under it. Nothing is ever written inside a free block.
+ * Class: CS 451 - HW2 Memory Allocator w/Buddy System
+ * Date: 2026 February 11
+ */
+
+#include "tree.h"
+#include "utils.h"
+#include <stdio.h>
+
+#define NONE 0xff           //node byte for a subtree w/no free block
+
+// Tree structure: nodes are stored level by level, root at index 1, children of node i at 2i and 2i+1
+// the tree spans 2^top bytes, enough to cover the pool, w/orders above u standing for groups of 2^u blocks
+// a node byte is cap(o) minus the largest free order under it, so the zeroed nodes mmalloc returns
+// mean every block is free, and NONE means none is
+typedef struct {
+    int l, u;               //min and max exponent of block sizes
+    int top;                //order of the root
+    unsigned char nodes[];  //2^(top-l+1) node bytes, index 0 unused
+} TreeT;
+
+//largest order a node of order o can hand out as one block
+static int cap(TreeT *t, int o){
+    return o < t->u ? o : t->u;
+}
+
+//largest free order under node i of order o, or -1 if none
+static int avail(TreeT *t, size_t i, int o){
+    return t->nodes[i] == NONE ? -1 : cap(t, o) - t->nodes[i];
+}
+
+//bytes of node storage for a tree
+static size_t nodebytes(int top, int l){
+    return sizeof(TreeT) + ((size_t)2 << (top - l));
+}
+
+//index of the node of order e covering offset
+static size_t node(TreeT *t, size_t offset, int e){
+    return ((size_t)1 << (t->top - e)) + (offset >> e);
+}
+
+/*  (1) recompute each ancestor of node i (order o) from its two children
+    (2) a node whose children are both wholly free is wholly free itself, up to order u
+    (3) stop early once an ancestor is unchanged, since nothing above it changes either
+*/
+static void fix(TreeT *t, size_t i, int o){
+    for (; i > 1; i >>= 1, o++){
+        size_t left = i & ~(size_t)1, right = i | 1;
+        int p = o + 1, largest;
+
+        if (t->nodes[left] == 0 && t->nodes[right] == 0 && p <= t->u)
+            largest = p;
+        else {
+            int a = avail(t, left, o), b = avail(t, right, o);
+            largest = a > b ? a : b;
+        }
+
+        unsigned char byte = largest < 0 ? NONE : cap(t, p) - largest;
+        if (t->nodes[i >> 1] == byte)
+            break;
+        t->nodes[i >> 1] = byte;
+    }
+}
+
+//root order, the smallest power of two covering the pool, and at least u
+static int toporder(size_t size, int u){
+    int top = size2e(size);
+    return top < u ? u : top;
+}
+
+//bytes of a tree for a pool, or 0 if its nodes can't be indexed
+extern size_t treebytes(size_t size, int l, int u){
+    int top = toporder(size, u);
+    if (top - l + 1 >= (int)(sizeof(size_t) * bitsperbyte))
+        return 0;
+    return nodebytes(top, l);
+}
+
+/*  (1) lay out tree in mem, which holds treebytes(size, l, u) zeroed bytes, so the whole span starts free
+    (2) walk down the path that straddles the end of the pool, marking what lies past it as full
+    (3) return pointer to tree
+*/
+extern Tree treeinit(void *mem, size_t size, int l, int u){
+    int top = toporder(size, u);
+    TreeT *t = mem;
+    t->l = l;
+    t->u = u;
+    t->top = top;
+
+    //only the nodes straddling the end of the pool, and their siblings past it, are touched
+    size_t i = 1, start = 0, marked = 0;
+    int o = top;
+    while (size < start + e2size(o)){
+        if (o == l){
+            t->nodes[marked = i] = NONE;        //granule only partly inside the pool
+            break;
+        }
+        size_t mid = start + e2size(o - 1);
+        i <<= 1;
+        o--;
+        if (size <= mid){
+            t->nodes[marked = i | 1] = NONE;    //upper half lies past the end
+            if (size == mid)
+                break;
+        } else {
+            i |= 1;                             //lower half is inside, keep following the end
+            start = mid;
+        }
+    }
+
+    //the deepest node marked is below every other one, so fixing its ancestors fixes theirs
+    if (marked)
+        fix(t, marked, o);
+
+    return t;
+}
+
+/*  (1) if the root has no free block of order e or more, fail
+    (2) walk down from the root, taking the lower child whenever it still has room for 2^e
+    (3) mark the order e node full, and fix its ancestors
+    (4) return offset of block, or -1 if there is none, w/the order of the free block it was cut from in *from
+*/
+extern long treealloc(Tree tree, int e, int *from){
+    TreeT *t = tree;
+    if (avail(t, 1, t->top) < e)
+        return -1;
+
+    //the first wholly free node on the way down is the free block the new one is cut from
+    size_t i = 1;
+    *from = -1;
+    for (int o = t->top; o > e; o--){
+        if (*from < 0 && o <= t->u && t->nodes[i] == 0)
+            *from = o;
+        i <<= 1;
+        if (avail(t, i, o - 1) < e)
+            i |= 1;
+    }
+    if (*from < 0)
+        *from = e;
+    t->nodes[i] = NONE;
+    fix(t, i, e);
+    return (i - ((size_t)1 << (t->top - e))) << e;
+}
+
+/*  (1) mark the order e node at offset wholly free, and fix its ancestors, which coalesces it w/free buddies
+    (2) return order of the free block it ended up in
+*/
+extern int treefree(Tree tree, size_t offset, int e){
+    TreeT *t = tree;
+    size_t i = node(t, offset, e);
+    t->nodes[i] = 0;
+    fix(t, i, e);
+
+    while (e < t->u && t->nodes[i >> 1] == 0){
+        i >>= 1;
+        e++;
+    }
+    return e;
+}
+
+/*  (1) shrink: mark the order ne node at offset full, and fix its ancestors, which frees the rest of the old block
+    (2) grow: check the upper buddy at each order from e to ne-1 is wholly free, and that offset is the lower one
+        clear the path from the old node up, since its subtree must read as free once the new block is freed,
+        then mark the order ne node full and fix its ancestors
+    (3) return 0 if the block at offset is now 2^ne, -1 if it can't grow in place
+*/
+extern int treeresize(Tree tree, size_t offset, int e, int ne){
+    TreeT *t = tree;
+    if (ne < e){
+        size_t i = node(t, offset, ne);
+        t->nodes[i] = NONE;
+        fix(t, i, ne);
+        return 0;
+    }
+
+    if (offset & (e2size(ne) - 1))
+        return -1;
+    size_t i = node(t, offset, e);
+    for (int k = e; k < ne; k++, i >>= 1){
+        if (t->nodes[i | 1] != 0)
+            return -1;
+    }
+    i = node(t, offset, e);
+    for (int k = e; k < ne; k++, i >>= 1)
+        t->nodes[i] = 0;
+    t->nodes[i] = NONE;
+    fix(t, i, ne);
+    return 0;
+}
+
+//call fn on every wholly free block of order e or more under node i, which has order o
+static void walk(TreeT *t, size_t i, int o, int e, void (*fn)(size_t, int, void *), void *arg){
+    if (avail(t, i, o) < e)
+        return;
+    if (o <= t->u && t->nodes[i] == 0){
+        fn((i - ((size_t)1 << (t->top - o))) << o, o, arg);
+        return;
+    }
+    walk(t, 2 * i, o - 1, e, fn, arg);
+    walk(t, 2 * i + 1, o - 1, e, fn, arg);
+}
+
+/*  (1) visit each free block of order e or more in address order, skipping subtrees w/none
+    (2) return nothing
+*/
+extern void treewalk(Tree tree, int e, void (*fn)(size_t offset, int e, void *arg), void *arg){
+    TreeT *t = tree;
+    walk(t, 1, t->top, e, fn, arg);
+}
+
+static void printblock(size_t offset, int e, void *arg){
+    (void)arg;
+    printf("offset %lu (block size %lu, 2^%d)\n", offset, e2size(e), e);
+}
+
+/*  (1) print largest free order in the whole tree
+    (2) print every free block
+    (3) return nothing
+*/
+extern void treeprint(Tree tree){
+    TreeT *t = tree;
+    printf("Largest free block: 2^%d\n", avail(t, 1, t->top));
+    treewalk(t, t->l, printblock, NULL);
+}
@@ -0,0 +1,20 @@
+// A bitmap tree of free space, for the Buddy System.
+
+#ifndef TREE_H
+#define TREE_H
+
+#include <stdio.h>
+
+typedef void *Tree;
+
+extern size_t treebytes(size_t size, int l, int u);
+extern Tree   treeinit(void *mem, size_t size, int l, int u);
+
+extern long treealloc(Tree t, int e, int *from);
+extern int  treefree(Tree t, size_t offset, int e);
+extern int  treeresize(Tree t, size_t offset, int e, int ne);
+
+extern void treewalk(Tree t, int e, void (*fn)(size_t offset, int e, void *arg), void *arg);
+extern void treeprint(Tree t);
+
+#endif
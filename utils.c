@@ -5,15 +5,18 @@
  */
 #include "utils.h"
 #include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
 #include <sys/mman.h>
 #include <stdio.h>
 
 /*  (1) round size up to multiple of page size
     (2) call mmap to allocate memory, with appropriate flags for anonymous private mapping
+        MAP_NORESERVE lets very large pools reserve address space w/out committing swap for it
     (3) return pointer to allocated memory, or (void *)-1 on failure
 */
 extern void *mmalloc(size_t size){
-    void *p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    void *p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
 
     if (p == MAP_FAILED){
         return (void*)-1;
@@ -21,6 +24,58 @@ extern void *mmalloc(size_t size){
     return p;
 }
 
+/*  (1) round size up to whole pages, and map 2^e - pagesize more, so an aligned start is in range
+    (2) unmap what lies before the first 2^e-aligned address, and after the rounded size
+    (3) return pointer to memory aligned to 2^e, or (void *)-1 on failure
+        mmfree(p, size) releases it like any mmalloc memory
+*/
+extern void *mmalign(size_t size, int e){
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t align = e2size(e);
+    if (align <= page)
+        return mmalloc(size);
+
+    size = divup(size, page) * page;
+    void *p = mmalloc(size + align - page);
+    if ((long)p == -1)
+        return p;
+
+    void *start = (void *)(((uintptr_t)p + align - 1) & ~(uintptr_t)(align - 1));
+    if (start > p)
+        munmap(p, start - p);
+    if (start + size < p + size + align - page)
+        munmap(start + size, (p + size + align - page) - (start + size));
+    return start;
+}
+
+/*  (1) reserve size bytes, rounded up to whole pages, and 2^e more, w/no access, so there is room to align in
+    (2) map fd over the reservation, w/flags MAP_SHARED or MAP_PRIVATE,
+        starting where p + skip is 2^e-aligned, and page-aligned at least
+    (3) unmap the rest of the reservation
+    (4) return pointer to mapping of fd, or (void *)-1 on failure
+        skip is a whole number of pages, and mmfree(p, size) releases it
+*/
+extern void *mmfile(int fd, size_t size, size_t skip, int e, int flags){
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t align = e2size(e) > page ? e2size(e) : page;
+
+    size = divup(size, page) * page;
+    void *p = mmap(0, size + align, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+        return (void *)-1;
+
+    void *start = (void *)((((uintptr_t)p + skip + align - 1) & ~(uintptr_t)(align - 1)) - skip);
+    if (mmap(start, size, PROT_READ | PROT_WRITE, flags | MAP_FIXED, fd, 0) == MAP_FAILED){
+        munmap(p, size + align);
+        return (void *)-1;
+    }
+    if (start > p)
+        munmap(p, start - p);
+    if (start + size < p + size + align)
+        munmap(start + size, (p + size + align) - (start + size));
+    return start;
+}
+
 /*  (1) call munmap to free memory, with appropriate size
     (2) return nothing
 */
@@ -35,6 +90,14 @@ extern size_t divup(size_t n, size_t d){
     return (n + d - 1) / d;
 }
 
+/*  (1) round at up to a cache line, and put that offset in *piece, so a piece of bytes placed there has the line to itself
+    (2) return offset just past the piece
+*/
+extern size_t place(size_t at, size_t bytes, size_t *piece){
+    *piece = divup(at, 64) * 64;
+    return *piece + bytes;
+}
+
 /*  (1) compute number of bytes needed to store
     (2) return result
 */  
@@ -49,18 +112,14 @@ extern size_t e2size(int e){
     return 1UL << e;
 }
 
-/*  (1) start with e = 0
-    (2) while 2^e < size, increment e
+/*  (1) sizes 0 and 1 fit in 2^0
+    (2) otherwise e is the bit length of size-1, from a count of leading zeros
     (3) return e
 */
 extern int size2e(size_t size){
-    int e = 0;
-    size_t s = s;
-    while((2^e) < size){
-        s <<= 1;
-        e++;
-    }
-    return e;
+    if (size <= 1)
+        return 0;
+    return sizeof(size_t) * bitsperbyte - __builtin_clzl(size - 1);
 }
 
 /*  (1) make pointer to byte
@@ -6,9 +6,12 @@
 static const int bitsperbyte=8;
 
 extern void *mmalloc(size_t size);
+extern void *mmalign(size_t size, int e);
+extern void *mmfile(int fd, size_t size, size_t skip, int e, int flags);
 extern void mmfree(void *p, size_t size);
 
 extern size_t divup(size_t n, size_t d);
+extern size_t place(size_t at, size_t bytes, size_t *piece);
 extern size_t bits2bytes(size_t bits);
 
 extern size_t e2size(int e);
@@ -1,26 +1,253 @@
 #include <string.h>
+#include <pthread.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
 
-#include "balloc.h"
+#include "heap.h"
+#include "trace.h"
+#include "utils.h"
 
-static Balloc bp=0;
+#define HEAPL      4              // smallest block order in every arena
+#define HEAPU      22             // arena order, larger requests get their own mmap
+
+static Heap hp=0;
+static pthread_once_t hponce=PTHREAD_ONCE_INIT;
+
+// Per-thread caches: one magazine of free blocks per small order. A
+// thread's malloc/free pairs are served from its own magazines with no
+// locking. Only an empty magazine is refilled, and only a full one
+// flushed, half a magazine at a time, in one bulk call to the shared
+// heap either way.
+
+#define CACHEL     HEAPL          // smallest cached order
+#define CACHEU     10             // largest cached order
+#define MAGSIZE    16             // blocks per magazine
+#define BATCH      (MAGSIZE/2)    // blocks moved per refill or flush
+#define CACHEBYTES (32*1024)      // most bytes one thread may hold cached
+
+typedef struct {
+  int n;
+  void *blocks[MAGSIZE];
+} Magazine;
+
+typedef struct {
+  int live;                       // 1 once destructor registered, -1 once thread exited
+  size_t bytes;
+  Magazine mags[CACHEU-CACHEL+1];
+} Cache;
+
+static __thread Cache cache __attribute__((tls_model("initial-exec")));
+static pthread_key_t cachekey;
+
+static void flush(Magazine *m, int e, int n) {
+  if (n>m->n)
+    n=m->n;
+  m->n-=n;
+  heapfree_bulk(hp,m->blocks+m->n,n);
+  cache.bytes-=n*e2size(e);
+}
+
+static void cachedelete(void *arg) {
+  (void)arg;
+  cache.live=-1;                  // later destructors' frees bypass the cache
+  for (int e=CACHEL; e<=CACHEU; e++)
+    flush(&cache.mags[e-CACHEL],e,MAGSIZE);
+}
+
+// Tracing: with BALLOC_TRACE=file in the environment, every call is
+// recorded to file, for the replay tool to play back against a pool.
+static Trace tr=0;
+
+static void hpinit(void) {
+  hp=heapcreate(HEAPL,HEAPU);
+  pthread_key_create(&cachekey,cachedelete);
+  const char *path=getenv("BALLOC_TRACE");
+  if (path)
+    tr=tracecreate(path);
+}
+
+// Record a call that handed out or gave back ptr. Calls that hand a
+// block out record after, and calls that give one back before, so
+// another thread can't record reusing ptr in between.
+static void trace(int op, void *ptr, size_t size) {
+  TraceRecord *r=tracenext(tr,op,size);
+  if (r)
+    r->ptr=(uintptr_t)ptr;
+}
+
+__attribute__((destructor)) static void traceend(void) {
+  Trace t=tr;
+  tr=0;
+  if (t)
+    traceclose(t);
+}
+
+static int order(size_t size) {
+  int e=size2e(size);
+  return e<CACHEL ? CACHEL : e;
+}
+
+// Register the destructor that flushes a thread's cache when it exits,
+// on its first malloc or free, whichever comes first.
+static void cachestart(void) {
+  if (!cache.live) {
+    cache.live=1;
+    pthread_setspecific(cachekey,&cache);
+  }
+}
+
+static void *cachealloc(int e) {
+  Magazine *m=&cache.mags[e-CACHEL];
+  cachestart();
+  if (m->n==0) {
+    size_t room=(CACHEBYTES-cache.bytes)>>e;
+    m->n=heapalloc_bulk(hp,e2size(e),room<BATCH ? room : BATCH,m->blocks);
+    cache.bytes+=m->n*e2size(e);
+  }
+  if (m->n==0)
+    return heapalloc(hp,e2size(e));
+  cache.bytes-=e2size(e);
+  return m->blocks[--m->n];
+}
+
+static void cachefree(void *mem, int e) {
+  Magazine *m=&cache.mags[e-CACHEL];
+  cachestart();
+  if (m->n==MAGSIZE)
+    flush(m,e,BATCH);
+  if (cache.bytes+e2size(e)>CACHEBYTES) {
+    heapfree(hp,mem);
+    return;
+  }
+  m->blocks[m->n++]=mem;
+  cache.bytes+=e2size(e);
+}
 
 #include <stdio.h>
 
+static void *alloc(size_t size) {
+  pthread_once(&hponce,hpinit);
+  if (!hp || size==0)
+    return 0;
+  int e=order(size);
+  if (e<=CACHEU && cache.live>=0)
+    return cachealloc(e);
+  return heapalloc(hp,size);
+}
+
 extern void *malloc(size_t size) {
-  bp=bp ? bp : bcreate(4096,4,12);
-  return balloc(bp,size);
+  void *mem=alloc(size);
+  if (tr && mem)
+    trace(TRACE_MALLOC,mem,size);
+  return mem;
 }
 
 extern void free(void *ptr) {
-  bfree(bp,ptr);
+  if (!hp || !ptr)
+    return;
+  size_t size=heapsize(hp,ptr);
+  if (!size)
+    return;
+  if (tr)
+    trace(TRACE_FREE,ptr,0);
+  int e=order(size);
+  if (e<=CACHEU && cache.live>=0)
+    cachefree(ptr,e);
+  else
+    heapfree(hp,ptr);
+}
+
+// Small zeroed requests come from the caches and are cleared here;
+// larger ones let the heap skip pages that are still zero.
+extern void *calloc(size_t n, size_t size) {
+  pthread_once(&hponce,hpinit);
+  if (!hp || n==0 || size==0 || n>(size_t)-1/size)
+    return 0;
+  int e=order(n*size);
+  void *mem;
+  if (e<=CACHEU && cache.live>=0) {
+    mem=cachealloc(e);
+    if (mem)
+      memset(mem,0,n*size);
+  } else {
+    mem=heapcalloc(hp,n,size);
+  }
+  if (tr && mem)
+    trace(TRACE_CALLOC,mem,n*size);
+  return mem;
+}
+
+// Aligned allocators. Every block is aligned to its own size, so an
+// aligned request is just a block of max(size,align) bytes, and small
+// ones still come from the caches. Traces record it as a malloc of
+// that many bytes.
+
+static void *aligned(size_t align, size_t size) {
+  pthread_once(&hponce,hpinit);
+  if (!hp || size==0)
+    return 0;
+  void *mem;
+  int e=order(size<align ? align : size);
+  if (align<=sizeof(void *))
+    mem=alloc(size);
+  else if (e<=CACHEU && cache.live>=0)
+    mem=cachealloc(e);
+  else
+    mem=heapalign(hp,size,align);
+  if (tr && mem)
+    trace(TRACE_MALLOC,mem,size<align ? align : size);
+  return mem;
+}
+
+extern int posix_memalign(void **memptr, size_t align, size_t size) {
+  if (align<sizeof(void *) || (align&(align-1)))
+    return EINVAL;
+  void *mem=aligned(align,size);
+  if (!mem && size)
+    return ENOMEM;
+  *memptr=mem;
+  return 0;
+}
+
+extern void *aligned_alloc(size_t align, size_t size) {
+  if (align==0 || (align&(align-1))) {
+    errno=EINVAL;
+    return 0;
+  }
+  return aligned(align,size);
+}
+
+extern void *memalign(size_t align, size_t size) {
+  return aligned_alloc(align,size);
+}
+
+extern void *valloc(size_t size) {
+  return aligned(sysconf(_SC_PAGESIZE),size);
 }
 
+// Blocks grow and shrink in place when their buddies allow, so a
+// growing vector or string usually isn't copied.
 extern void *realloc(void *ptr, size_t size) {
-  size_t min(size_t x, size_t y) { return x<y ? x : y; }
-  void *new=malloc(size);
   if (!ptr)
-    return new;
-  memcpy(new,ptr,min(size,bsize(bp,ptr)));
-  free(ptr);
-  return new;
+    return malloc(size);
+  if (size==0) {
+    free(ptr);
+    return 0;
+  }
+  if (!hp || !heapsize(hp,ptr))
+    return 0;
+  // realloc both gives back and hands out, so it gets a record on
+  // each side of the call
+  TraceRecord *r=tr ? tracenext(tr,TRACE_REALLOC,size) : 0;
+  if (r)
+    r->ptr=(uintptr_t)ptr;
+  void *mem=heaprealloc(hp,ptr,size);
+  TraceRecord *done=r ? tracenext(tr,TRACE_RESIZED,size) : 0;
+  if (done) {
+    done->ptr=(uintptr_t)mem;
+    done->ref=r->ref;
+  }
+  return mem;
 }